@@ -0,0 +1,136 @@
+#ifndef BINARY_WRITER_HPP
+#define BINARY_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+// Little-endian binary frames for the websocket. Columns are padded to 8 bytes so the client can view
+// them in place as Int32Array/Float64Array instead of reading value by value.
+class BinaryWriter
+{
+private:
+	string buf;
+
+	static bool little_endian()
+	{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+		return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+#else
+		const uint16_t one = 1;
+		return *(const char*)&one == 1;
+#endif
+	}
+
+	void put(uint64_t v, int n_bytes)
+	{
+		for(int i = 0; i < n_bytes; ++i)
+			buf += (char)((v >> (8 * i)) & 0xff);
+	}
+
+	// a whole column in one copy on little-endian hosts, byte by byte otherwise
+	template<typename T, typename U>
+	void put_column(const T *values, size_t n)
+	{
+		align(8);
+		if(little_endian())
+		{
+			buf.append((const char*)values, n * sizeof(T));
+			return;
+		}
+
+		for(size_t i = 0; i < n; ++i)
+		{
+			U bits;
+			memcpy(&bits, &values[i], sizeof(T));
+			put(bits, sizeof(T));
+		}
+	}
+
+public:
+	BinaryWriter(size_t capacity = 4096)
+	{
+		buf.reserve(capacity);
+	}
+
+	// writer of the calling thread, cleared and ready for a new frame
+	static BinaryWriter& thread_writer()
+	{
+		static thread_local BinaryWriter writer(1 << 16);
+		writer.clear();
+		return writer;
+	}
+
+	BinaryWriter& u8(uint8_t v)
+	{
+		buf += (char)v;
+		return *this;
+	}
+
+	BinaryWriter& u16(uint16_t v)
+	{
+		put(v, 2);
+		return *this;
+	}
+
+	BinaryWriter& u32(uint32_t v)
+	{
+		put(v, 4);
+		return *this;
+	}
+
+	// u16 length then the bytes, longer strings are cut
+	BinaryWriter& text(const string &v)
+	{
+		size_t n = v.size() < 0xffff ? v.size() : 0xffff;
+		put(n, 2);
+		buf.append(v.data(), n);
+		return *this;
+	}
+
+	// zero bytes up to the next multiple of n from the start of the frame
+	BinaryWriter& align(size_t n)
+	{
+		while(buf.size() % n)
+			buf += '\0';
+		return *this;
+	}
+
+	BinaryWriter& column(const vector<int32_t> &values)
+	{
+		put_column<int32_t, uint32_t>(values.data(), values.size());
+		return *this;
+	}
+
+	BinaryWriter& column(const vector<uint32_t> &values)
+	{
+		put_column<uint32_t, uint32_t>(values.data(), values.size());
+		return *this;
+	}
+
+	BinaryWriter& column(const vector<double> &values)
+	{
+		put_column<double, uint64_t>(values.data(), values.size());
+		return *this;
+	}
+
+	const string& str() const
+	{
+		return buf;
+	}
+
+	size_t size() const
+	{
+		return buf.size();
+	}
+
+	void clear()
+	{
+		buf.clear();
+	}
+};
+
+#endif
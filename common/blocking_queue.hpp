@@ -0,0 +1,71 @@
+#ifndef BLOCKING_QUEUE_HPP
+#define BLOCKING_QUEUE_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+using namespace std;
+
+// bounded multi-producer multi-consumer queue, producers block while the queue is full
+// so a fast producer can never run far ahead of slow consumers
+template<class T>
+class BlockingQueue
+{
+private:
+	size_t capacity;
+	bool closed;
+	deque<T> items;
+	mutex mtx;
+	condition_variable not_empty;
+	condition_variable not_full;
+
+public:
+	BlockingQueue(size_t capacity = 64):capacity(capacity),closed(false){}
+
+	// return false if the queue has been closed and the item is dropped
+	bool push(T item)
+	{
+		unique_lock<mutex> lock(mtx);
+		not_full.wait(lock, [this]{ return closed || items.size() < capacity; });
+
+		if(closed)
+			return false;
+
+		items.push_back(move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	// block until an item is available, return false once the queue is closed and drained
+	bool pop(T& item)
+	{
+		unique_lock<mutex> lock(mtx);
+		not_empty.wait(lock, [this]{ return closed || !items.empty(); });
+
+		if(items.empty())
+			return false;
+
+		item = move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	// no more pushes, consumers drain what is left and then stop
+	void close()
+	{
+		lock_guard<mutex> lock(mtx);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+	size_t size()
+	{
+		lock_guard<mutex> lock(mtx);
+		return items.size();
+	}
+};
+
+#endif
@@ -14,6 +14,36 @@ private:
         Configuration()
 	{
 		debug = true;
+		quote_poll_seconds = 60;
+		quote_batch_size = 100;
+		server_threads = 0;
+		init_server_threads = 0;
+		booking_server_threads = 0;
+		risk_server_threads = 2;
+		worker_threads = 0;
+		deflate_min_bytes = 1024;
+		deflate_level = 6;
+		deflate_mem_level = 8;
+		deflate_window_bits = 15;
+		deflate_context_takeover = true;
+		send_budget_bytes = 4 << 20;
+		slow_consumer_seconds = 30;
+		init_refresh_seconds = 60;
+		chart_cache_bytes = 64 << 20;
+		chart_revalidate_seconds = 60;
+		quote_store_symbols = 256;
+		search_results = 20;
+		search_symbol_weight = 100;
+		search_name_weight = 40;
+		search_quotes_weight = 30;
+		search_popularity_weight = 10;
+		deal_page_size_max = 1000;
+		journal_path = "trades.journal";
+		journal_apply_batch = 500;
+		journal_rotate_bytes = 64 << 20;
+		basket_max_trades = 100000;
+		limit_history_days = 252;
+		limit_default_volatility = 0.03;
 		if(dev_env)
 		{
 			server = "tcp://127.0.0.1:3306";
@@ -36,6 +66,36 @@ public:
 	string db_password;
 	string db_name;
 	bool debug; // debug mode or not
+	int quote_poll_seconds; // cadence of the latest quote poller
+	int quote_batch_size; // tickers per latest quote request
+	int server_threads; // io threads shared by all end points, 0 for one per core
+	int init_server_threads; // dedicated io threads of an end point, 0 to run on the shared ones
+	int booking_server_threads;
+	int risk_server_threads;
+	int worker_threads; // task scheduler threads for heavy handler work, 0 for one per core
+	int deflate_min_bytes; // replies smaller than this go out uncompressed
+	int deflate_level; // zlib level 1 (fast) to 9 (small)
+	int deflate_mem_level; // zlib memory level 1 to 9
+	int deflate_window_bits; // 9 to 15, the client may negotiate it lower
+	bool deflate_context_takeover; // false resets the compressor for every message, less memory and a worse ratio
+	int send_budget_bytes; // unsent bytes a connection may have queued before pushed updates are held back, replies are cut at 4 times this
+	int slow_consumer_seconds; // a connection over its budget this long is disconnected
+	int init_refresh_seconds; // rebuild the init message this often to pick up tables changed outside the server, 0 never
+	int chart_cache_bytes; // serialized charts kept, least recently used go first
+	int chart_revalidate_seconds; // a cached chart older than this is checked against the quotes before reuse
+	int quote_store_symbols; // daily bars kept in memory for this many symbols, see quote_store.hpp
+	int search_results; // tickers a search returns at most
+	int search_symbol_weight; // score of a symbol starting with the query, twice that for the whole symbol
+	int search_name_weight; // of a word of the company name starting with it
+	int search_quotes_weight; // added for tickers with quotes to chart
+	int search_popularity_weight; // added per doubling of the times a ticker was charted
+	int deal_page_size_max; // rows a deal listing page may ask for
+	string journal_path; // bookings are acknowledged once in this file and applied to Deal after, "" books straight into the db
+	int journal_apply_batch; // journaled trades applied to Deal per transaction
+	int journal_rotate_bytes; // the journal is emptied once everything in it is applied and it is this big
+	int basket_max_trades; // trades one basket booking may carry
+	int limit_history_days; // quote dates the covariance of the pre-trade VaR limit is estimated over
+	double limit_default_volatility; // daily volatility of tickers with too little history for it
 
         static Configuration* get_instance()
         {
@@ -4,28 +4,75 @@
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <curl/curlbuild.h>
+#include <string>
+#include <stdexcept>
+
+using namespace std;
 
 class CURLDownloader
 {
 private:
 	static CURLDownloader *instance;
-	void *curl;
+	CURL *curl;
 
-	CURLDownloader()
+	static size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
+	{
+		((string*)userdata)->append(ptr, size * nmemb);
+		return size * nmemb;
+	}
+
+public:
+	// libcurl global state is not thread safe, call it once from the main thread before downloading on other threads
+	static void global_init()
 	{
 		curl_global_init(CURL_GLOBAL_ALL); // extension of library loader
+	}
+
+	// keep the constructor public so that every download thread can own an easy handle
+	CURLDownloader()
+	{
 		curl = curl_easy_init();
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+		curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
 	}
-public:
+
 	static CURLDownloader* get_instance()
 	{
 		if(!instance)
-			instance = new CURLDownloader()
+		{
+			global_init();
+			instance = new CURLDownloader();
+		}
 
 		return instance;
 	}
 
+	// body of the url, throws runtime_error if the request fails
+	string download(string url)
+	{
+		string body;
+		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+		CURLcode res = curl_easy_perform(curl);
+		if(res != CURLE_OK)
+			throw runtime_error("fail to download " + url + ": " + curl_easy_strerror(res));
+
+		long status = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		if(status != 200)
+			throw runtime_error("fail to download " + url + ": http status " + to_string(status));
 
+		return body;
+	}
+
+	~CURLDownloader()
+	{
+		curl_easy_cleanup(curl);
+	}
 };
 
 CURLDownloader* CURLDownloader::instance = NULL;
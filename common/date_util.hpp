@@ -0,0 +1,57 @@
+#ifndef DATE_UTIL_HPP
+#define DATE_UTIL_HPP
+
+#include <string>
+#include <cstdio>
+
+using namespace std;
+
+// dates are carried around as days since 1970-01-01, which sorts, subtracts and packs into an int
+// (civil calendar conversion from http://howardhinnant.github.io/date_algorithms.html)
+inline int days_from_civil(int y, int m, int d)
+{
+	y -= m <= 2;
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// yyyy-mm-dd (anything after the day is ignored), -1 if it is not a date
+inline int parse_day(const string &date)
+{
+	if(date.size() < 10 || date[4] != '-' || date[7] != '-')
+		return -1;
+
+	for(int i : {0, 1, 2, 3, 5, 6, 8, 9})
+		if(date[i] < '0' || date[i] > '9')
+			return -1;
+
+	int y = (date[0] - '0') * 1000 + (date[1] - '0') * 100 + (date[2] - '0') * 10 + (date[3] - '0');
+	int m = (date[5] - '0') * 10 + (date[6] - '0');
+	int d = (date[8] - '0') * 10 + (date[9] - '0');
+	if(m < 1 || m > 12 || d < 1 || d > 31)
+		return -1;
+
+	return days_from_civil(y, m, d);
+}
+
+inline string format_day(int day)
+{
+	int z = day + 719468;
+	int era = (z >= 0 ? z : z - 146096) / 146097;
+	int doe = z - era * 146097;
+	int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int mp = (5 * doy + 2) / 153;
+	int d = doy - (153 * mp + 2) / 5 + 1;
+	int m = mp + (mp < 10 ? 3 : -9);
+	int y = yoe + era * 400 + (m <= 2);
+
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%04d-%02d-%02d", y, m, d);
+	return buf;
+}
+
+#endif
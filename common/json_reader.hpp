@@ -0,0 +1,183 @@
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <string>
+#include <stdexcept>
+
+using namespace std;
+
+// Pull parser over a json buffer, nothing is materialized: the caller walks the document and skips what it does not need.
+//   reader.expect('{');
+//   while(reader.read_key(key)) { if(key == "puts") ...; else reader.skip_value(); }
+// Bare keys and values (google finance style {expiry:{y:2017}}) are accepted as well.
+class JsonReader
+{
+private:
+	const char *p;
+	const char *end;
+
+	void skip_space()
+	{
+		while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+			++p;
+	}
+
+	void fail(string what)
+	{
+		throw runtime_error("json: " + what + " at " + string(p, min(end - p, (ptrdiff_t)20)));
+	}
+
+public:
+	JsonReader(const char *begin, const char *end):p(begin),end(end){}
+	JsonReader(const string &json):p(json.data()),end(json.data() + json.size()){}
+
+	bool at_end()
+	{
+		skip_space();
+		return p >= end;
+	}
+
+	char peek()
+	{
+		skip_space();
+		return p < end ? *p : '\0';
+	}
+
+	void expect(char c)
+	{
+		skip_space();
+		if(p >= end || *p != c)
+			fail(string("expect '") + c + "'");
+		++p;
+	}
+
+	// string value or a bare token (number, true, false, null), escapes are decoded
+	void read_string(string &out)
+	{
+		out.clear();
+		skip_space();
+		if(p >= end)
+			fail("unexpected end");
+
+		if(*p != '"')
+		{
+			const char *b = p;
+			while(p < end && *p != ',' && *p != ':' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+				++p;
+			if(p == b)
+				fail("unexpected character");
+			out.assign(b, p);
+			return;
+		}
+
+		++p;
+		const char *b = p;
+		while(p < end && *p != '"')
+		{
+			if(*p != '\\')
+			{
+				++p;
+				continue;
+			}
+
+			// slow path, only for strings with escapes
+			out.append(b, p);
+			if(++p >= end)
+				break;
+
+			switch(*p)
+			{
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+				{
+					if(end - p < 5)
+						fail("bad unicode escape");
+					unsigned code = stoul(string(p + 1, p + 5), NULL, 16);
+					if(code < 0x80)
+						out += (char)code;
+					else if(code < 0x800)
+					{
+						out += (char)(0xC0 | (code >> 6));
+						out += (char)(0x80 | (code & 0x3F));
+					}
+					else
+					{
+						out += (char)(0xE0 | (code >> 12));
+						out += (char)(0x80 | ((code >> 6) & 0x3F));
+						out += (char)(0x80 | (code & 0x3F));
+					}
+					p += 4;
+					break;
+				}
+				default: out += *p; break;
+			}
+			b = ++p;
+		}
+
+		if(p >= end)
+			fail("unterminated string");
+
+		out.append(b, p);
+		++p;
+	}
+
+	// next key of the current object, false (and the closing brace consumed) at the end of the object
+	bool read_key(string &key)
+	{
+		skip_space();
+		if(p < end && *p == '}')
+		{
+			++p;
+			return false;
+		}
+
+		if(p < end && *p == ',')
+			++p;
+
+		read_string(key);
+		expect(':');
+		return true;
+	}
+
+	// true if there is another element in the current array, false (and the closing bracket consumed) at the end
+	bool next_element()
+	{
+		skip_space();
+		if(p < end && *p == ']')
+		{
+			++p;
+			return false;
+		}
+
+		if(p < end && *p == ',')
+			++p;
+
+		return true;
+	}
+
+	void skip_value()
+	{
+		char c = peek();
+		string ignored;
+		if(c == '{')
+		{
+			++p;
+			while(read_key(ignored))
+				skip_value();
+		}
+		else if(c == '[')
+		{
+			++p;
+			while(next_element())
+				skip_value();
+		}
+		else
+			read_string(ignored);
+	}
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+using namespace std;
+
+// Streaming json writer, commas and nesting are tracked so callers only say what comes next:
+//   writer.begin_object().key("ticker").value("AAPL").key("quotes").begin_array() ... end_array().end_object();
+// The buffer keeps its capacity across clear(), so a writer reused for every reply stops allocating
+// once it has seen the largest document (see thread_writer).
+class JsonWriter
+{
+private:
+	string buf;
+	vector<char> has_value; // per open object/array, whether a comma is needed before the next element
+	bool after_key;
+
+	void separate()
+	{
+		if(after_key)
+		{
+			after_key = false;
+			return;
+		}
+
+		if(!has_value.empty())
+		{
+			if(has_value.back())
+				buf += ',';
+			has_value.back() = 1;
+		}
+	}
+
+	void append_escaped(const char *s, size_t n)
+	{
+		buf += '"';
+		const char *run = s;
+		const char *end = s + n;
+		for(const char *p = s; p < end; ++p)
+		{
+			unsigned char c = *p;
+			if(c >= 0x20 && c != '"' && c != '\\')
+				continue;
+
+			buf.append(run, p);
+			switch(c)
+			{
+				case '"': buf += "\\\""; break;
+				case '\\': buf += "\\\\"; break;
+				case '\n': buf += "\\n"; break;
+				case '\r': buf += "\\r"; break;
+				case '\t': buf += "\\t"; break;
+				default:
+				{
+					char esc[8];
+					snprintf(esc, sizeof(esc), "\\u%04x", c);
+					buf += esc;
+				}
+			}
+			run = p + 1;
+		}
+
+		buf.append(run, end);
+		buf += '"';
+	}
+
+public:
+	JsonWriter(size_t capacity = 4096):after_key(false)
+	{
+		buf.reserve(capacity);
+		has_value.reserve(16);
+	}
+
+	// writer of the calling thread, cleared and ready for a new document
+	static JsonWriter& thread_writer()
+	{
+		static thread_local JsonWriter writer(1 << 16);
+		writer.clear();
+		return writer;
+	}
+
+	// shortest representation that reads back to the same double, integers without a fraction, null for nan/inf
+	static size_t format_double(double val, char *out)
+	{
+		if(!isfinite(val))
+		{
+			memcpy(out, "null", 4);
+			return 4;
+		}
+
+		// range first, casting a double outside long long is undefined
+		if(fabs(val) < 1e15 && val == (double)(long long)val)
+			return snprintf(out, 32, "%lld", (long long)val);
+
+		// prices and most computed values have a few decimals, print those without going through printf
+		static const double pow10[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8};
+		for(int decimals = 1; decimals <= 8 && fabs(val) < 1e9; ++decimals)
+		{
+			double rounded = floor(val * pow10[decimals] + 0.5);
+			if(rounded / pow10[decimals] != val) // exact integers over a power of ten read back the same way
+				continue;
+
+			long long digits = (long long)fabs(rounded);
+			for(; digits % 10 == 0; digits /= 10)
+				--decimals;
+
+			char tmp[32];
+			size_t n = 0;
+			for(int i = 0; i < decimals; ++i, digits /= 10)
+				tmp[n++] = '0' + digits % 10;
+			tmp[n++] = '.';
+			do
+			{
+				tmp[n++] = '0' + digits % 10;
+				digits /= 10;
+			} while(digits);
+			if(val < 0)
+				tmp[n++] = '-';
+
+			for(size_t i = 0; i < n; ++i)
+				out[i] = tmp[n - 1 - i];
+			return n;
+		}
+
+		size_t n = snprintf(out, 32, "%.15g", val);
+		if(strtod(out, NULL) == val)
+			return n;
+
+		return snprintf(out, 32, "%.17g", val);
+	}
+
+	JsonWriter& begin_object()
+	{
+		separate();
+		buf += '{';
+		has_value.push_back(0);
+		return *this;
+	}
+
+	JsonWriter& end_object()
+	{
+		buf += '}';
+		has_value.pop_back();
+		return *this;
+	}
+
+	JsonWriter& begin_array()
+	{
+		separate();
+		buf += '[';
+		has_value.push_back(0);
+		return *this;
+	}
+
+	JsonWriter& end_array()
+	{
+		buf += ']';
+		has_value.pop_back();
+		return *this;
+	}
+
+	JsonWriter& key(const char *k)
+	{
+		return key(k, strlen(k));
+	}
+
+	JsonWriter& key(const string &k)
+	{
+		return key(k.data(), k.size());
+	}
+
+	JsonWriter& key(const char *k, size_t n)
+	{
+		separate();
+		append_escaped(k, n);
+		buf += ':';
+		after_key = true;
+		return *this;
+	}
+
+	JsonWriter& value(const string &v)
+	{
+		separate();
+		append_escaped(v.data(), v.size());
+		return *this;
+	}
+
+	JsonWriter& value(const char *v)
+	{
+		separate();
+		append_escaped(v, strlen(v));
+		return *this;
+	}
+
+	JsonWriter& value(double v)
+	{
+		separate();
+		char num[32];
+		buf.append(num, format_double(v, num));
+		return *this;
+	}
+
+	JsonWriter& value(long long v)
+	{
+		separate();
+		char num[32];
+		buf.append(num, snprintf(num, sizeof(num), "%lld", v));
+		return *this;
+	}
+
+	JsonWriter& value(int v)
+	{
+		return value((long long)v);
+	}
+
+	JsonWriter& value(bool v)
+	{
+		separate();
+		buf += v ? "true" : "false";
+		return *this;
+	}
+
+	JsonWriter& null()
+	{
+		separate();
+		buf += "null";
+		return *this;
+	}
+
+	// an already serialized json value
+	JsonWriter& raw(const string &json)
+	{
+		separate();
+		buf += json;
+		return *this;
+	}
+
+	const string& str() const
+	{
+		return buf;
+	}
+
+	size_t size() const
+	{
+		return buf.size();
+	}
+
+	void clear()
+	{
+		buf.clear();
+		has_value.clear();
+		after_key = false;
+	}
+};
+
+#endif
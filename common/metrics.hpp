@@ -0,0 +1,274 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+using namespace std;
+
+// Latency histogram with log-linear buckets: exact below 16ns, then every power of two split into 16,
+// so any percentile is within about 6% of the true value. Recording is a few relaxed atomic adds.
+class Histogram
+{
+private:
+	static const int sub_buckets = 16;
+	static const int max_bit = 47; // about 39 hours in ns, longer is counted there
+	static const int n_buckets = (max_bit - 2) * sub_buckets;
+
+	atomic<uint64_t> buckets[n_buckets];
+	atomic<uint64_t> n;
+	atomic<uint64_t> sum;
+	atomic<uint64_t> maximum;
+
+	static int bucket_of(uint64_t v)
+	{
+		if(v < (uint64_t)sub_buckets)
+			return v;
+
+		int bit = 63 - __builtin_clzll(v);
+		if(bit > max_bit)
+			return n_buckets - 1;
+
+		return (bit - 3) * sub_buckets + ((v >> (bit - 4)) & (sub_buckets - 1));
+	}
+
+	// smallest value of a bucket
+	static uint64_t lower_bound(int bucket)
+	{
+		int group = bucket / sub_buckets;
+		uint64_t sub = bucket % sub_buckets;
+		if(group == 0)
+			return sub;
+
+		return (sub_buckets + sub) << (group - 1);
+	}
+
+public:
+	Histogram():n(0), sum(0), maximum(0)
+	{
+		for(int i = 0; i < n_buckets; ++i)
+			buckets[i] = 0;
+	}
+
+	void record(long long ns)
+	{
+		uint64_t v = ns > 0 ? ns : 0;
+		buckets[bucket_of(v)].fetch_add(1, memory_order_relaxed);
+		n.fetch_add(1, memory_order_relaxed);
+		sum.fetch_add(v, memory_order_relaxed);
+
+		uint64_t seen = maximum.load(memory_order_relaxed);
+		while(v > seen && !maximum.compare_exchange_weak(seen, v, memory_order_relaxed));
+	}
+
+	uint64_t count() const
+	{
+		return n.load(memory_order_relaxed);
+	}
+
+	uint64_t sum_ns() const
+	{
+		return sum.load(memory_order_relaxed);
+	}
+
+	uint64_t max_ns() const
+	{
+		return maximum.load(memory_order_relaxed);
+	}
+
+	// value at quantile q (0.5, 0.99, ...), the middle of the bucket it falls in
+	uint64_t percentile_ns(double q) const
+	{
+		uint64_t total = count();
+		if(total == 0)
+			return 0;
+
+		uint64_t rank = (uint64_t)(q * total + 0.5);
+		if(rank < 1)
+			rank = 1;
+
+		uint64_t seen = 0;
+		for(int i = 0; i < n_buckets; ++i)
+		{
+			seen += buckets[i].load(memory_order_relaxed);
+			if(seen >= rank)
+			{
+				uint64_t low = lower_bound(i), high = i + 1 < n_buckets ? lower_bound(i + 1) : low + 1;
+				uint64_t mid = low + (high - low - 1) / 2;
+				return mid < max_ns() ? mid : max_ns();
+			}
+		}
+
+		return max_ns();
+	}
+};
+
+// Process wide registry of counters and histograms, found by name and labels ("op=\"booking\"").
+// Series live as long as the process, so callers may keep the pointers. Lookups go through a cache
+// of the calling thread and only take the lock the first time a thread asks for a series.
+class Metrics
+{
+private:
+	static Metrics *instance;
+	static const size_t max_series = 1024; // labels may come from clients, past this they share one series
+
+	mutex mtx;
+	map<string, map<string, unique_ptr<Histogram>>> histograms; // name -> labels -> histogram
+	map<string, map<string, unique_ptr<atomic<long long>>>> counters;
+	size_t n_series;
+
+	Metrics():n_series(0){}
+
+	template<typename T>
+	T* find(map<string, map<string, unique_ptr<T>>> &series, unordered_map<string, T*> &cache, const string &name, const string &labels)
+	{
+		string key = name + '{' + labels + '}';
+		auto cached = cache.find(key);
+		if(cached != cache.end())
+			return cached->second;
+
+		T *found;
+		{
+			lock_guard<mutex> lock(mtx);
+			map<string, unique_ptr<T>> &named = series[name];
+			auto it = named.find(labels);
+			if(it == named.end() && n_series >= max_series)
+				it = named.find("op=\"other\"");
+
+			if(it != named.end())
+				found = it->second.get();
+			else
+			{
+				found = new T();
+				named[n_series < max_series ? labels : "op=\"other\""].reset(found);
+				++n_series;
+			}
+		}
+
+		cache[key] = found;
+		return found;
+	}
+
+	static void write_value(string &out, const string &name, const string &labels, const string &extra, const char *value)
+	{
+		out += name;
+		if(!labels.empty() || !extra.empty())
+		{
+			out += '{';
+			out += labels;
+			if(!labels.empty() && !extra.empty())
+				out += ',';
+			out += extra;
+			out += '}';
+		}
+		out += ' ';
+		out += value;
+		out += '\n';
+	}
+
+public:
+	static Metrics* get_instance()
+	{
+		if(!instance)
+			instance = new Metrics();
+
+		return instance;
+	}
+
+	static long long now_ns()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// ns the calling thread spent in the db since it last reset it, see MysqlManager
+	static long long& thread_db_ns()
+	{
+		static thread_local long long db_ns = 0;
+		return db_ns;
+	}
+
+	Histogram* histogram(const string &name, const string &labels = "")
+	{
+		static thread_local unordered_map<string, Histogram*> cache;
+		return find(histograms, cache, name, labels);
+	}
+
+	atomic<long long>* counter(const string &name, const string &labels = "")
+	{
+		static thread_local unordered_map<string, atomic<long long>*> cache;
+		return find(counters, cache, name, labels);
+	}
+
+	// every series in the Prometheus text format, histograms as summaries in microseconds
+	string exposition()
+	{
+		string out;
+		char value[64];
+		lock_guard<mutex> lock(mtx);
+
+		for(auto it = counters.begin(); it != counters.end(); ++it)
+		{
+			out += "# TYPE " + it->first + " counter\n";
+			for(auto s = it->second.begin(); s != it->second.end(); ++s)
+			{
+				snprintf(value, sizeof(value), "%lld", s->second->load());
+				write_value(out, it->first, s->first, "", value);
+			}
+		}
+
+		const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+		for(auto it = histograms.begin(); it != histograms.end(); ++it)
+		{
+			out += "# TYPE " + it->first + " summary\n";
+			for(auto s = it->second.begin(); s != it->second.end(); ++s)
+			{
+				const Histogram &h = *s->second;
+				for(int q = 0; q < 4; ++q)
+				{
+					snprintf(value, sizeof(value), "%.1f", h.percentile_ns(quantiles[q]) / 1e3);
+					char quantile[32];
+					snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", quantiles[q]);
+					write_value(out, it->first, s->first, quantile, value);
+				}
+
+				snprintf(value, sizeof(value), "%llu", (unsigned long long)h.count());
+				write_value(out, it->first + "_count", s->first, "", value);
+				snprintf(value, sizeof(value), "%.1f", h.sum_ns() / 1e3);
+				write_value(out, it->first + "_sum", s->first, "", value);
+				snprintf(value, sizeof(value), "%.1f", h.max_ns() / 1e3);
+				write_value(out, it->first + "_max", s->first, "", value);
+			}
+		}
+
+		return out;
+	}
+};
+
+Metrics *Metrics::instance = NULL;
+
+// records the time from construction to destruction into a histogram and the thread's db time
+class DbTimer
+{
+private:
+	long long start;
+
+public:
+	DbTimer():start(Metrics::now_ns()){}
+
+	~DbTimer()
+	{
+		long long elapsed = Metrics::now_ns() - start;
+		Metrics::thread_db_ns() += elapsed;
+		static Histogram *db_query = Metrics::get_instance()->histogram("db_query_us");
+		db_query->record(elapsed);
+	}
+};
+
+#endif
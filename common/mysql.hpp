@@ -4,6 +4,8 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <memory>
 #include <cppconn/driver.h>
 #include <cppconn/exception.h>
 #include <cppconn/resultset.h>
@@ -12,6 +14,7 @@
 #include "mysql_driver.h"
 #include "mysql_connection.h"
 #include "configuration.hpp"
+#include "metrics.hpp"
 
 using namespace std;
 
@@ -26,7 +29,7 @@ private:
 	sql::Connection *con;
 	sql::Statement *stmt;
 	sql::PreparedStatement *pstmt;
-	static MysqlManager *instance;
+	static thread_local MysqlManager *instance; // one connection per thread, a connection is not thread safe
 	static Configuration* config;
 
 public:
@@ -46,9 +49,17 @@ public:
 		return instance;
 	}
 
+	// drop the calling thread's connection, e.g. once it is lost, the next get_instance connects again
+	static void reset()
+	{
+		delete instance;
+		instance = NULL;
+	}
+
 	int executeUpdate(string query, vector<vector<string>> values)
 	{
 		int row_affected = 0;
+		DbTimer timer;
 		
 		pstmt = con->prepareStatement(query);
 		
@@ -73,21 +84,121 @@ public:
 		return row_affected;
 	}
 
+	// insert records with multi-row statements of batch_size rows each instead of one round trip per row
+	// query stops right after "values", suffix follows the place holders (e.g. "on duplicate key update ...")
+	// Record binds its own fields (see option_record.hpp)
+	template<class Record>
+	int executeBatchUpdate(string query, const vector<Record>& records, string suffix = "", int batch_size = 500)
+	{
+		return batchUpdate(query, records, suffix, batch_size, false);
+	}
+
+	// same as executeBatchUpdate but all or nothing: the rows are committed in one transaction,
+	// return -1 and roll back if any batch fails. then, if given, runs last in the same transaction
+	// (e.g. to record how far the rows go)
+	template<class Record>
+	int executeBatchUpdateAtomically(string query, const vector<Record>& records, string suffix = "", int batch_size = 500, string then = "")
+	{
+		int row_affected = -1;
+		con->setAutoCommit(false);
+
+		try
+		{
+			row_affected = batchUpdate(query, records, suffix, batch_size, true);
+			if(!then.empty())
+			{
+				DbTimer timer;
+				unique_ptr<sql::Statement> then_stmt(con->createStatement());
+				then_stmt->execute(then);
+			}
+			con->commit();
+		}catch(sql::SQLException &e)
+		{
+			cout << "fail to update, roll back:" << e.what() << endl;
+			con->rollback();
+			row_affected = -1;
+		}
+
+		con->setAutoCommit(true);
+		return row_affected;
+	}
+
 	sql::ResultSet* executeQuery(string query)
 	{
+		DbTimer timer; // the driver buffers the whole result, so this covers fetching it
 		stmt = con->createStatement();
 		sql::ResultSet* rs = stmt->executeQuery(query);
 		delete stmt;
 		return rs;
 	}
 
+	// query with ? placeholders bound to params in order, for values that come from outside
+	sql::ResultSet* executeQuery(string query, const vector<string> &params)
+	{
+		DbTimer timer;
+		unique_ptr<sql::PreparedStatement> query_pstmt(con->prepareStatement(query));
+		for(size_t param_index = 0; param_index < params.size(); ++param_index)
+			query_pstmt->setString(param_index + 1, params[param_index]);
+
+		return query_pstmt->executeQuery();
+	}
+
+private:
+	template<class Record>
+	int batchUpdate(string query, const vector<Record>& records, string suffix, int batch_size, bool throw_on_error)
+	{
+		int row_affected = 0;
+
+		string row_place_holder = "(?";
+		for(int field_index = 1; field_index < Record::field_num; ++field_index)
+			row_place_holder += ",?";
+		row_place_holder += ")";
+
+		unique_ptr<sql::PreparedStatement> batch_pstmt;
+		int prepared_rows = 0;
+
+		for(size_t record_index = 0; record_index < records.size(); record_index += batch_size)
+		{
+			int rows = min((size_t)batch_size, records.size() - record_index);
+
+			// full batches share one statement, only the tail needs its own
+			if(rows != prepared_rows)
+			{
+				string batch_query = query + " " + row_place_holder;
+				for(int row_index = 1; row_index < rows; ++row_index)
+					batch_query += "," + row_place_holder;
+
+				batch_pstmt.reset(con->prepareStatement(batch_query + " " + suffix));
+				prepared_rows = rows;
+			}
+
+			for(int row_index = 0; row_index < rows; ++row_index)
+				records[record_index + row_index].bind(batch_pstmt.get(), row_index * Record::field_num + 1);
+
+			try
+			{
+				DbTimer timer;
+				row_affected += batch_pstmt->executeUpdate();
+			}catch(sql::SQLException &e)
+			{
+				if(throw_on_error)
+					throw;
+
+				cout << "fail to update:" << e.what() << endl;
+			}
+		}
+
+		return row_affected;
+	}
+
+public:
 	~MysqlManager()
 	{
 		delete con;
 	}
 };
 
-MysqlManager *MysqlManager::instance = NULL;
+thread_local MysqlManager *MysqlManager::instance = NULL;
 Configuration *MysqlManager::config = Configuration::get_instance();
 
 #endif
@@ -0,0 +1,98 @@
+#ifndef OPTION_RECORD_HPP
+#define OPTION_RECORD_HPP
+
+#include <string>
+#include <cppconn/prepared_statement.h>
+#include <cppconn/datatype.h>
+
+using namespace std;
+
+// one row of HistoricalOptionChain
+struct OptionRecord
+{
+	string ticker;
+	string type; // call or put
+	double underlyingPrice;
+	double mid;
+	string pricingDate;
+	double strike;
+	string expiration;
+
+	static const int field_num = 7;
+
+	// bind this record to the place holders starting from index (1 based, like jdbc)
+	void bind(sql::PreparedStatement *pstmt, int index) const
+	{
+		pstmt->setString(index, ticker);
+		pstmt->setString(index + 1, type);
+		pstmt->setDouble(index + 2, underlyingPrice);
+		pstmt->setDouble(index + 3, mid);
+		pstmt->setString(index + 4, pricingDate);
+		pstmt->setDouble(index + 5, strike);
+		pstmt->setString(index + 6, expiration);
+	}
+};
+
+// one row of OptionQuotes, in the column order of the table
+struct OptionQuote
+{
+	double ask;
+	double bid;
+	double change;
+	string contractSize;
+	string contractSymbol;
+	string currency;
+	string expiration;
+	double impliedVolatility; // NAN when the source does not provide it
+	bool inTheMoney;
+	double lastPrice;
+	string lastTradeDate; // empty when the source does not provide it
+	double openInterest;
+	double percentChange;
+	double strike;
+	double volume;
+	string pricingDate;
+	string underlying;
+	double underlyingPrice;
+	string type; // call or put
+	double mid;
+
+	static const int field_num = 20;
+
+	static void bind_double(sql::PreparedStatement *pstmt, int index, double val)
+	{
+		if(val != val) // nan
+			pstmt->setNull(index, sql::DataType::DOUBLE);
+		else
+			pstmt->setDouble(index, val);
+	}
+
+	void bind(sql::PreparedStatement *pstmt, int index) const
+	{
+		bind_double(pstmt, index, ask);
+		bind_double(pstmt, index + 1, bid);
+		bind_double(pstmt, index + 2, change);
+		pstmt->setString(index + 3, contractSize);
+		pstmt->setString(index + 4, contractSymbol);
+		pstmt->setString(index + 5, currency);
+		pstmt->setString(index + 6, expiration);
+		bind_double(pstmt, index + 7, impliedVolatility);
+		pstmt->setBoolean(index + 8, inTheMoney);
+		bind_double(pstmt, index + 9, lastPrice);
+		if(lastTradeDate.empty())
+			pstmt->setNull(index + 10, sql::DataType::TIMESTAMP);
+		else
+			pstmt->setString(index + 10, lastTradeDate);
+		bind_double(pstmt, index + 11, openInterest);
+		bind_double(pstmt, index + 12, percentChange);
+		bind_double(pstmt, index + 13, strike);
+		bind_double(pstmt, index + 14, volume);
+		pstmt->setString(index + 15, pricingDate);
+		pstmt->setString(index + 16, underlying);
+		bind_double(pstmt, index + 17, underlyingPrice);
+		pstmt->setString(index + 18, type);
+		bind_double(pstmt, index + 19, mid);
+	}
+};
+
+#endif
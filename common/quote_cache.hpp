@@ -0,0 +1,171 @@
+#ifndef QUOTE_CACHE_HPP
+#define QUOTE_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+struct CachedQuote
+{
+	double price;
+	string trade_time; // as reported by the feed
+	chrono::steady_clock::time_point updated;
+};
+
+// Last trade price of every ticker, shared by the poller that fills it and everything that prices off it.
+// Readers asking for prices fresher than what is cached do not each go to the feed, and neither does the
+// poller while they do: only one fetch is in flight at a time and the others wait for its result.
+class QuoteCache
+{
+private:
+	static QuoteCache *instance;
+	mutex mtx;
+	condition_variable refreshed;
+	unordered_map<string, CachedQuote> quotes;
+	bool refreshing;
+	function<void(const vector<string>&)> fetcher; // pulls the given tickers from the feed and calls update
+	vector<function<void(const vector<string>&)>> listeners; // told which tickers got new prices
+
+	vector<string> stale_tickers(const vector<string> &tickers, chrono::steady_clock::duration max_age)
+	{
+		vector<string> stale;
+		auto oldest = chrono::steady_clock::now() - max_age;
+		for(auto it = tickers.begin(); it != tickers.end(); ++it)
+		{
+			auto quote = quotes.find(*it);
+			if(quote == quotes.end() || quote->second.updated < oldest)
+				stale.push_back(*it);
+		}
+
+		return stale;
+	}
+
+	// with lock held and no fetch in flight, the fetcher runs unlocked and whoever waits is woken after
+	void fetch(unique_lock<mutex> &lock, const vector<string> &tickers)
+	{
+		if(!fetcher)
+			return;
+
+		refreshing = true;
+		auto fetch_tickers = fetcher;
+		lock.unlock();
+
+		try{
+			fetch_tickers(tickers);
+		}catch(const std::exception &exc){
+			cout << "failed to refresh quotes because:" << exc.what() << endl;
+		}
+
+		lock.lock();
+		refreshing = false;
+		refreshed.notify_all();
+	}
+
+public:
+	QuoteCache():refreshing(false){}
+
+	static QuoteCache* get_instance()
+	{
+		if(!instance)
+			instance = new QuoteCache();
+
+		return instance;
+	}
+
+	void set_fetcher(function<void(const vector<string>&)> f)
+	{
+		lock_guard<mutex> lock(mtx);
+		fetcher = f;
+	}
+
+	void add_listener(function<void(const vector<string>&)> listener)
+	{
+		lock_guard<mutex> lock(mtx);
+		listeners.push_back(listener);
+	}
+
+	// called by whoever updated tickers once the batch is in, listeners run on the caller's thread
+	void notify(const vector<string> &tickers)
+	{
+		vector<function<void(const vector<string>&)>> to_notify;
+		{
+			lock_guard<mutex> lock(mtx);
+			to_notify = listeners;
+		}
+
+		for(auto it = to_notify.begin(); it != to_notify.end(); ++it)
+			(*it)(tickers);
+	}
+
+	void update(string ticker, double price, string trade_time)
+	{
+		lock_guard<mutex> lock(mtx);
+		CachedQuote &quote = quotes[ticker];
+		quote.price = price;
+		quote.trade_time = trade_time;
+		quote.updated = chrono::steady_clock::now();
+	}
+
+	bool get(string ticker, CachedQuote &quote)
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = quotes.find(ticker);
+		if(it == quotes.end())
+			return false;
+
+		quote = it->second;
+		return true;
+	}
+
+	// fetch tickers from the feed, after the fetch in flight if there is one, so the poller and readers never
+	// pull at the same time
+	void refresh(const vector<string> &tickers)
+	{
+		unique_lock<mutex> lock(mtx);
+		refreshed.wait(lock, [this]{ return !refreshing; });
+		fetch(lock, tickers);
+	}
+
+	// prices of tickers no older than max_age, tickers the feed does not know or could not refresh are left out.
+	// Stale tickers are fetched at most once per call, joining a fetch already in flight when there is one.
+	unordered_map<string, double> get_fresh(const vector<string> &tickers, chrono::steady_clock::duration max_age)
+	{
+		unique_lock<mutex> lock(mtx);
+		vector<string> stale = stale_tickers(tickers, max_age);
+
+		if(!stale.empty() && fetcher)
+		{
+			// somebody else is fetching, most likely the same tickers
+			if(refreshing)
+			{
+				refreshed.wait(lock, [this]{ return !refreshing; });
+				stale = stale_tickers(tickers, max_age);
+			}
+
+			if(!stale.empty())
+				fetch(lock, stale);
+		}
+
+		unordered_map<string, double> prices;
+		auto oldest = chrono::steady_clock::now() - max_age;
+		for(auto it = tickers.begin(); it != tickers.end(); ++it)
+		{
+			auto quote = quotes.find(*it);
+			if(quote != quotes.end() && quote->second.updated >= oldest)
+				prices[*it] = quote->second.price;
+		}
+
+		return prices;
+	}
+};
+
+QuoteCache *QuoteCache::instance = NULL;
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef QUOTE_POLLER_HPP
+#define QUOTE_POLLER_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include "quote.hpp"
+#include "quote_cache.hpp"
+
+using namespace std;
+
+// Polls the latest trade of a ticker list at a fixed cadence into the QuoteCache.
+// The feed takes a comma joined instrument list, so tickers go batch_size at a time instead of one request each.
+class QuotePoller
+{
+private:
+	vector<string> tickers;
+	chrono::seconds cadence;
+	size_t batch_size;
+	QuoteCache *cache;
+	bool running;
+	mutex mtx;
+	condition_variable stopped;
+	thread worker;
+
+	// "GOOG",970.12,"6/9/2017","4:00pm"
+	static vector<string> split_csv_line(const string &line)
+	{
+		vector<string> fields(1);
+		bool quoted = false;
+		for(auto it = line.begin(); it != line.end(); ++it)
+		{
+			if(*it == '"')
+				quoted = !quoted;
+			else if(*it == ',' && !quoted)
+				fields.push_back("");
+			else if(*it != '\r')
+				fields.back() += *it;
+		}
+
+		return fields;
+	}
+
+	void fetch_batch(const string &instruments)
+	{
+		string csv = quote::getLatestQuotesCsv(instruments, {quote::QuoteType::symbol,
+								     quote::QuoteType::lastTradePriceOnly,
+								     quote::QuoteType::lastTradeDate,
+								     quote::QuoteType::lastTradeTime});
+		stringstream response(csv);
+		string line;
+		vector<string> updated;
+		while(getline(response, line, '\n'))
+		{
+			vector<string> fields = split_csv_line(line);
+			if(fields.size() != 4)
+				continue;
+
+			char *end_ptr;
+			double price = strtod(fields[1].c_str(), &end_ptr);
+			if(fields[1].empty() || *end_ptr != '\0') // N/A for unknown symbols
+				continue;
+
+			cache->update(fields[0], price, fields[2] + " " + fields[3]);
+			updated.push_back(fields[0]);
+		}
+
+		if(!updated.empty())
+			cache->notify(updated);
+	}
+
+	void poll()
+	{
+		unique_lock<mutex> lock(mtx);
+		while(running)
+		{
+			lock.unlock();
+			cache->refresh(tickers);
+			lock.lock();
+			stopped.wait_for(lock, cadence, [this]{ return !running; });
+		}
+	}
+
+public:
+	QuotePoller(vector<string> tickers, chrono::seconds cadence = chrono::seconds(60), size_t batch_size = 100, QuoteCache *cache = QuoteCache::get_instance())
+		:tickers(tickers),cadence(cadence),batch_size(batch_size > 0 ? batch_size : 1),cache(cache),running(false)
+	{
+		// readers finding a ticker stale pull it through the same batched path
+		cache->set_fetcher([this](const vector<string> &stale){ fetch(stale); });
+	}
+
+	// one round over the given tickers, a failed batch does not stop the others
+	void fetch(const vector<string> &fetch_tickers)
+	{
+		for(size_t batch_start = 0; batch_start < fetch_tickers.size(); batch_start += batch_size)
+		{
+			string instruments;
+			for(size_t i = batch_start; i < fetch_tickers.size() && i < batch_start + batch_size; ++i)
+				instruments += (i == batch_start ? "" : ",") + fetch_tickers[i];
+
+			try{
+				fetch_batch(instruments);
+			}catch(const std::exception &exc){
+				cout << "failed to get latest quotes for " << instruments << " because:" << exc.what() << endl;
+			}
+		}
+	}
+
+	void start()
+	{
+		lock_guard<mutex> lock(mtx);
+		if(running)
+			return;
+
+		running = true;
+		worker = thread(&QuotePoller::poll, this);
+	}
+
+	void stop()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			running = false;
+			stopped.notify_all();
+		}
+
+		if(worker.joinable())
+			worker.join();
+	}
+
+	~QuotePoller()
+	{
+		cache->set_fetcher(nullptr);
+		stop();
+	}
+};
+
+#endif
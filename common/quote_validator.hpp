@@ -0,0 +1,258 @@
+#ifndef QUOTE_VALIDATOR_HPP
+#define QUOTE_VALIDATOR_HPP
+
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <cppconn/prepared_statement.h>
+#include <cppconn/datatype.h>
+#include "date_util.hpp"
+
+using namespace std;
+
+// daily bars of one symbol stored column by column, so every check is a tight loop over plain arrays
+struct QuoteBatch
+{
+	string symbol;
+	vector<int> day; // days since epoch, see date_util.hpp
+	vector<double> open;
+	vector<double> high;
+	vector<double> low;
+	vector<double> close;
+	vector<double> volume;
+	vector<double> adj_close;
+
+	size_t size() const { return day.size(); }
+
+	void reserve(size_t n)
+	{
+		day.reserve(n);
+		open.reserve(n);
+		high.reserve(n);
+		low.reserve(n);
+		close.reserve(n);
+		volume.reserve(n);
+		adj_close.reserve(n);
+	}
+
+	void push_back(int d, double o, double h, double l, double c, double v, double ac)
+	{
+		day.push_back(d);
+		open.push_back(o);
+		high.push_back(h);
+		low.push_back(l);
+		close.push_back(c);
+		volume.push_back(v);
+		adj_close.push_back(ac);
+	}
+
+	// reorder rows by date, downloads come newest first
+	void sort_by_day()
+	{
+		if(is_sorted(day.begin(), day.end()))
+			return;
+
+		vector<size_t> order(size());
+		iota(order.begin(), order.end(), 0);
+		stable_sort(order.begin(), order.end(), [this](size_t a, size_t b){ return day[a] < day[b]; });
+
+		QuoteBatch sorted;
+		sorted.symbol = symbol;
+		sorted.reserve(size());
+		for(auto it = order.begin(); it != order.end(); ++it)
+			sorted.push_back(day[*it], open[*it], high[*it], low[*it], close[*it], volume[*it], adj_close[*it]);
+
+		*this = move(sorted);
+	}
+};
+
+// one row of a batch in the column order of Quotes (Symbol, Date, Open, High, Low, Close, Volume, Adj_Close)
+struct QuoteRow
+{
+	const QuoteBatch *batch;
+	size_t index;
+
+	static const int field_num = 8;
+
+	// quarantined rows are the ones with nan or infinite fields, those are stored as NULL
+	static void bind_double(sql::PreparedStatement *pstmt, int index, double val)
+	{
+		if(!isfinite(val))
+			pstmt->setNull(index, sql::DataType::DECIMAL);
+		else
+			pstmt->setDouble(index, val);
+	}
+
+	void bind(sql::PreparedStatement *pstmt, int i) const
+	{
+		pstmt->setString(i, batch->symbol);
+		if(batch->day[index] < 0) // the date did not parse
+			pstmt->setNull(i + 1, sql::DataType::DATE);
+		else
+			pstmt->setString(i + 1, format_day(batch->day[index]));
+		bind_double(pstmt, i + 2, batch->open[index]);
+		bind_double(pstmt, i + 3, batch->high[index]);
+		bind_double(pstmt, i + 4, batch->low[index]);
+		bind_double(pstmt, i + 5, batch->close[index]);
+		bind_double(pstmt, i + 6, batch->volume[index]);
+		bind_double(pstmt, i + 7, batch->adj_close[index]);
+	}
+};
+
+// a row of QuoteQuarantine: the quote as downloaded plus why it was rejected
+struct QuarantinedQuoteRow
+{
+	QuoteRow row;
+	string reason;
+
+	static const int field_num = QuoteRow::field_num + 1;
+
+	void bind(sql::PreparedStatement *pstmt, int i) const
+	{
+		row.bind(pstmt, i);
+		pstmt->setString(i + QuoteRow::field_num, reason);
+	}
+};
+
+// name of the QuoteValidator::Flag at bit
+inline const char* quote_flag_name(int bit)
+{
+	static const char *names[] = {"non positive price", "missing value", "high below low", "open/close outside high-low", "price spike", "duplicate date", "unconfirmed jump"};
+	return names[bit];
+}
+
+struct QuoteQualityStats
+{
+	string symbol;
+	size_t rows;
+	size_t quarantined;
+	size_t flag_count[7]; // rows hit by each check, in QuoteValidator::Flag bit order
+
+	string to_string() const
+	{
+		string stats = symbol + ": " + std::to_string(rows) + " rows, " + std::to_string(quarantined) + " quarantined";
+		for(int bit = 0; bit < 7; ++bit)
+			if(flag_count[bit] > 0)
+				stats += ", " + std::to_string(flag_count[bit]) + " " + quote_flag_name(bit);
+		return stats;
+	}
+};
+
+// Bad prints would otherwise go straight into Quotes and into the returns VarianceCovarianceVAR is built on.
+// Every check runs over the whole batch as a branch free loop that ors its bit into a flag column,
+// which the compiler vectorizes, so validating costs far less than parsing the download.
+class QuoteValidator
+{
+private:
+	double max_jump; // relative close to close move that counts as a spike
+
+public:
+	enum Flag
+	{
+		NON_POSITIVE_PRICE = 1 << 0,
+		MISSING_VALUE      = 1 << 1,
+		HIGH_BELOW_LOW     = 1 << 2,
+		OUTSIDE_RANGE      = 1 << 3,
+		SPIKE              = 1 << 4,
+		DUPLICATE_DATE     = 1 << 5,
+		UNCONFIRMED_JUMP   = 1 << 6
+	};
+
+	QuoteValidator(double max_jump = 0.5):max_jump(max_jump){}
+
+	// one flag byte per row, 0 means the row is clean. The batch must be sorted by day. last_close is the
+	// close stored before the batch's first day, nan if there is none, so the first bar is checked too.
+	vector<uint8_t> validate(const QuoteBatch &batch, double last_close = NAN)
+	{
+		size_t n = batch.size();
+		vector<uint8_t> flags(n, 0);
+		uint8_t *f = flags.data();
+		const double *o = batch.open.data(), *h = batch.high.data(), *l = batch.low.data(), *c = batch.close.data();
+		const double *v = batch.volume.data();
+		const int *d = batch.day.data();
+
+		for(size_t i = 0; i < n; ++i)
+			f[i] |= (uint8_t)((o[i] <= 0) | (h[i] <= 0) | (l[i] <= 0) | (c[i] <= 0)) * NON_POSITIVE_PRICE;
+
+		// nan compares unequal to itself, a date that did not parse is day -1
+		for(size_t i = 0; i < n; ++i)
+			f[i] |= (uint8_t)((o[i] != o[i]) | (h[i] != h[i]) | (l[i] != l[i]) | (c[i] != c[i]) | (v[i] != v[i]) | (v[i] < 0) | (d[i] < 0)) * MISSING_VALUE;
+
+		for(size_t i = 0; i < n; ++i)
+			f[i] |= (uint8_t)(h[i] < l[i]) * HIGH_BELOW_LOW;
+
+		for(size_t i = 0; i < n; ++i)
+			f[i] |= (uint8_t)((o[i] > h[i]) | (o[i] < l[i]) | (c[i] > h[i]) | (c[i] < l[i])) * OUTSIDE_RANGE;
+
+		// a spike jumps away from both neighbours and comes back, a genuine gap only moves once
+		for(size_t i = 0; i + 1 < n; ++i)
+		{
+			double from_prev = c[i] / (i > 0 ? c[i - 1] : last_close) - 1;
+			double to_next = c[i + 1] / c[i] - 1;
+			f[i] |= (uint8_t)((fabs(from_prev) > max_jump) & (fabs(to_next) > max_jump) & ((from_prev > 0) != (to_next > 0))) * SPIKE;
+		}
+
+		// the newest bar has nothing after it to come back to yet, a jump there waits for review
+		if(n > 0)
+		{
+			double from_prev = c[n - 1] / (n > 1 ? c[n - 2] : last_close) - 1;
+			f[n - 1] |= (uint8_t)(fabs(from_prev) > max_jump) * UNCONFIRMED_JUMP;
+		}
+
+		// the first print of a day is kept
+		for(size_t i = 1; i < n; ++i)
+			f[i] |= (uint8_t)(d[i] == d[i - 1]) * DUPLICATE_DATE;
+
+		return flags;
+	}
+
+	static string reason(uint8_t flag)
+	{
+		string reason;
+		for(int bit = 0; bit < 7; ++bit)
+		{
+			if(flag & (1 << bit))
+			{
+				if(!reason.empty())
+					reason += ",";
+				reason += quote_flag_name(bit);
+			}
+		}
+
+		return reason;
+	}
+
+	// split the batch into rows to insert and rows to quarantine, and count what was found
+	QuoteQualityStats split(const QuoteBatch &batch, const vector<uint8_t> &flags, vector<QuoteRow> &clean, vector<QuarantinedQuoteRow> &quarantined)
+	{
+		QuoteQualityStats stats;
+		stats.symbol = batch.symbol;
+		stats.rows = batch.size();
+		stats.quarantined = 0;
+		fill(stats.flag_count, stats.flag_count + 7, 0);
+
+		for(size_t i = 0; i < flags.size(); ++i)
+		{
+			QuoteRow row = {&batch, i};
+			if(flags[i] == 0)
+			{
+				clean.push_back(row);
+				continue;
+			}
+
+			++stats.quarantined;
+			for(int bit = 0; bit < 7; ++bit)
+				stats.flag_count[bit] += (flags[i] >> bit) & 1;
+
+			QuarantinedQuoteRow bad = {row, reason(flags[i])};
+			quarantined.push_back(bad);
+		}
+
+		return stats;
+	}
+};
+
+#endif
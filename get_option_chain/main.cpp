@@ -0,0 +1,125 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ctime>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "mysql.hpp"
+#include "curl_downloader.hpp"
+#include "blocking_queue.hpp"
+#include "option_chain_parser.hpp"
+
+using namespace std;
+
+int nDownloader = 16;
+int nWriter = 4;
+string url = "https://finance.google.com/finance/option_chain?output=json&q=";
+
+vector<string> get_tickers()
+{
+	vector<string> tickers;
+
+	MysqlManager *mysql_manager = MysqlManager::get_instance();
+	sql::ResultSet* res = mysql_manager->executeQuery("select Symbol from Tickers");
+
+	while(res->next())
+	{
+		tickers.push_back(res->getString("Symbol"));
+	}
+
+	return tickers;
+}
+
+string now()
+{
+	time_t t = time(0);
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	return buf;
+}
+
+// the first page holds the nearest expiry and the list of all expiries, the others are fetched one by one
+vector<OptionQuote> download_option_chain(CURLDownloader &downloader, string ticker, string pricing_date)
+{
+	OptionChainPage first_page = OptionChainParser::parse(downloader.download(url + ticker), ticker, pricing_date);
+	vector<OptionQuote> quotes = move(first_page.quotes);
+
+	for(auto it = first_page.expirations.begin(); it != first_page.expirations.end(); ++it)
+	{
+		if(*it == first_page.expiry)
+			continue;
+
+		// yyyy-mm-dd
+		string expiry_query = "&expy=" + it->substr(0, 4) + "&expm=" + to_string(stoi(it->substr(5, 2))) + "&expd=" + to_string(stoi(it->substr(8, 2)));
+		OptionChainPage page = OptionChainParser::parse(downloader.download(url + ticker + expiry_query), ticker, pricing_date);
+		quotes.insert(quotes.end(), page.quotes.begin(), page.quotes.end());
+	}
+
+	return quotes;
+}
+
+void download_option_chains(vector<string> *tickers, atomic<size_t> *next_ticker, string pricing_date, BlockingQueue<vector<OptionQuote>> *chains)
+{
+	CURLDownloader downloader;
+	size_t ticker_index;
+	while((ticker_index = (*next_ticker)++) < tickers->size())
+	{
+		string ticker = (*tickers)[ticker_index];
+		try{
+			chains->push(download_option_chain(downloader, ticker, pricing_date));
+		}catch(const std::exception &exc){
+			cout << "failed to update " << ticker << " because:" << exc.what() << endl;
+		}
+	}
+}
+
+void write_option_chains(BlockingQueue<vector<OptionQuote>> *chains)
+{
+	string query = "insert into OptionQuotes (ask, bid, `change`, contractSize, contractSymbol, currency, expiration, impliedVolatility, "
+		       "inTheMoney, lastPrice, lastTradeDate, openInterest, percentChange, strike, volume, pricingDate, underlying, "
+		       "underlyingPrice, type, mid) values";
+	// a rerun on the same pricing date takes the new quotes rather than failing the whole batch
+	string upsert = "on duplicate key update ask=values(ask), bid=values(bid), `change`=values(`change`), impliedVolatility=values(impliedVolatility), "
+			"inTheMoney=values(inTheMoney), lastPrice=values(lastPrice), lastTradeDate=values(lastTradeDate), openInterest=values(openInterest), "
+			"percentChange=values(percentChange), volume=values(volume), underlyingPrice=values(underlyingPrice), mid=values(mid)";
+	unique_ptr<MysqlManager> mysql_manager(new MysqlManager());
+
+	vector<OptionQuote> chain;
+	while(chains->pop(chain))
+	{
+		int row_affected = mysql_manager->executeBatchUpdate(query, chain, upsert);
+		if(!chain.empty())
+			cout << "update " << chain.front().underlying << " with " << row_affected << " options" << endl;
+	}
+}
+
+int main(int argc, const char * argv[]) {
+	vector<string> tickers = get_tickers();
+	string pricing_date = now();
+	time_t st = time(0);
+
+	CURLDownloader::global_init();
+
+	BlockingQueue<vector<OptionQuote>> chains(2 * nDownloader);
+	vector<thread> writers;
+	for(int i = 0; i < nWriter; ++i)
+		writers.push_back(thread(write_option_chains, &chains));
+
+	atomic<size_t> next_ticker(0);
+	vector<thread> downloaders;
+	for(int i = 0; i < nDownloader; ++i)
+		downloaders.push_back(thread(download_option_chains, &tickers, &next_ticker, pricing_date, &chains));
+
+	for(auto it = downloaders.begin(); it != downloaders.end(); ++it)
+		it->join();
+
+	chains.close();
+	for(auto it = writers.begin(); it != writers.end(); ++it)
+		it->join();
+
+	cout << difftime(time(0), st) << " seconds" << endl;
+	cout << "finish" << endl;
+	return 0;
+}
@@ -0,0 +1,160 @@
+#ifndef OPTION_CHAIN_PARSER_HPP
+#define OPTION_CHAIN_PARSER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include "json_reader.hpp"
+#include "option_record.hpp"
+
+using namespace std;
+
+// one response of the option chain service (see get_quote/json.txt): the chain of a single expiry
+struct OptionChainPage
+{
+	string expiry; // yyyy-mm-dd of the chain in this page
+	vector<string> expirations; // yyyy-mm-dd of every expiry the underlying has
+	vector<OptionQuote> quotes;
+};
+
+class OptionChainParser
+{
+private:
+	// "1,234", "+0.01", "-" (no quote, counted as 0 like the yahoo feed the python updater used)
+	static double to_number(const string &val)
+	{
+		if(val.empty() || val == "-")
+			return 0;
+
+		string digits;
+		digits.reserve(val.size());
+		for(auto it = val.begin(); it != val.end(); ++it)
+			if(*it != ',')
+				digits += *it;
+
+		return strtod(digits.c_str(), NULL);
+	}
+
+	// a side of the market, "-" when nobody quotes it is nan and stored as NULL, not a price of 0
+	static double to_price(const string &val)
+	{
+		return (val.empty() || val == "-") ? NAN : to_number(val);
+	}
+
+	static string two_digits(const string &val)
+	{
+		return val.size() == 1 ? "0" + val : val;
+	}
+
+	// {"y":"2017","m":"6","d":"16"} -> 2017-06-16
+	static string read_date(JsonReader &reader)
+	{
+		string key, val, y, m, d;
+		reader.expect('{');
+		while(reader.read_key(key))
+		{
+			reader.read_string(val);
+			if(key == "y")
+				y = val;
+			else if(key == "m")
+				m = two_digits(val);
+			else if(key == "d")
+				d = two_digits(val);
+		}
+
+		return y + "-" + m + "-" + d;
+	}
+
+	static void read_quotes(JsonReader &reader, string type, vector<OptionQuote> &quotes)
+	{
+		string key, val;
+		reader.expect('[');
+		while(reader.next_element())
+		{
+			OptionQuote quote;
+			quote.ask = quote.bid = quote.change = quote.lastPrice = 0;
+			quote.openInterest = quote.percentChange = quote.strike = quote.volume = 0;
+			quote.impliedVolatility = NAN;
+			quote.contractSize = "REGULAR";
+			quote.currency = "USD";
+			quote.type = type;
+
+			reader.expect('{');
+			while(reader.read_key(key))
+			{
+				reader.read_string(val);
+				if(key == "s")
+					quote.contractSymbol = val;
+				else if(key == "p")
+					quote.lastPrice = to_number(val);
+				else if(key == "c")
+					quote.change = to_number(val);
+				else if(key == "cp")
+					quote.percentChange = to_number(val);
+				else if(key == "b")
+					quote.bid = to_price(val);
+				else if(key == "a")
+					quote.ask = to_price(val);
+				else if(key == "oi")
+					quote.openInterest = to_number(val);
+				else if(key == "vol")
+					quote.volume = to_number(val);
+				else if(key == "strike")
+					quote.strike = to_number(val);
+			}
+
+			quotes.push_back(move(quote));
+		}
+	}
+
+public:
+	// parse one page, underlying and pricing_date are stamped on every quote
+	static OptionChainPage parse(const string &json, string underlying, string pricing_date)
+	{
+		OptionChainPage page;
+		double underlying_price = 0;
+
+		JsonReader reader(json);
+		string key, val;
+		reader.expect('{');
+		while(reader.read_key(key))
+		{
+			if(key == "expiry")
+				page.expiry = read_date(reader);
+			else if(key == "expirations")
+			{
+				reader.expect('[');
+				while(reader.next_element())
+					page.expirations.push_back(read_date(reader));
+			}
+			else if(key == "puts")
+				read_quotes(reader, "put", page.quotes);
+			else if(key == "calls")
+				read_quotes(reader, "call", page.quotes);
+			else if(key == "underlying_price")
+			{
+				reader.read_string(val);
+				underlying_price = to_number(val);
+			}
+			else
+				reader.skip_value();
+		}
+
+		// underlying_price comes after the chains, so the derived fields are filled at the end.
+		// The python updater had to guess the type from inTheMoney, here the side is known and inTheMoney follows from it.
+		for(auto it = page.quotes.begin(); it != page.quotes.end(); ++it)
+		{
+			it->expiration = page.expiry + " 00:00:00";
+			it->pricingDate = pricing_date;
+			it->underlying = underlying;
+			it->underlyingPrice = underlying_price;
+			it->inTheMoney = it->type == "call" ? underlying_price > it->strike : underlying_price < it->strike;
+			it->mid = (it->ask + it->bid)/2.; // nan, so NULL, when either side is missing
+		}
+
+		return page;
+	}
+};
+
+#endif
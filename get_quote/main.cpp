@@ -4,12 +4,21 @@
 #include <algorithm>
 #include "quote.hpp"
 #include "mysql.hpp"
+#include "quote_validator.hpp"
+#include "date_util.hpp"
 #include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/range/iterator_range.hpp>
 #include <ctime>
+#include <cmath>
+#include <stdexcept>
 #include "cpp_call_python.hpp"
+#include "quote_poller.hpp"
+#include "configuration.hpp"
+#include <thread>
+#include <chrono>
+#include <memory>
 
 using namespace std;
 
@@ -28,63 +37,106 @@ vector<string> get_tickers()
 	return tickers;
 }
 
+// "null" and other unparsable fields become nan and are caught by the validator
+double to_double(const string &val)
+{
+	char *end_ptr;
+	double d = strtod(val.c_str(), &end_ptr);
+	return (val.empty() || *end_ptr != '\0') ? NAN : d;
+}
+
+// csv of the download into a columnar batch, columns are looked up by header so their order does not matter
+QuoteBatch parse_quotes_csv(string ticker, const string &csv)
+{
+	QuoteBatch batch;
+	batch.symbol = ticker;
+
+	stringstream response(csv);
+	string headers;
+	getline(response, headers, '\n');
+	vector<string> headers_list;
+	boost::split(headers_list, headers, boost::is_any_of(","));
+
+	// Date, Open, High, Low, Close, Volume, Adj Close
+	const char *columns[] = {"Date", "Open", "High", "Low", "Close", "Volume", "Adj Close"};
+	int column_index[7];
+	for(int i = 0; i < 7; ++i)
+	{
+		auto it = find(headers_list.begin(), headers_list.end(), columns[i]);
+		if(it == headers_list.end())
+			throw runtime_error(string("no ") + columns[i] + " column in the download");
+		column_index[i] = it - headers_list.begin();
+	}
+
+	string values;
+	vector<string> vals;
+	while(getline(response, values, '\n'))
+	{
+		boost::split(vals, values, boost::is_any_of(","));
+		if(vals.size() != headers_list.size())
+			continue;
+
+		batch.push_back(parse_day(vals[column_index[0]]),
+				to_double(vals[column_index[1]]), to_double(vals[column_index[2]]), to_double(vals[column_index[3]]),
+				to_double(vals[column_index[4]]), to_double(vals[column_index[5]]), to_double(vals[column_index[6]]));
+	}
+
+	batch.sort_by_day();
+	return batch;
+}
+
+// close stored for ticker before day, nan if there is none, so the first downloaded bar is checked against it
+double last_close_before(const string &ticker, int day)
+{
+	MysqlManager *mysql_manager = MysqlManager::get_instance();
+	unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Close from Quotes where Symbol=? and Date<? order by Date desc limit 1",
+								  {ticker, format_day(day)}));
+	return res->next() ? (double)res->getDouble("Close") : NAN;
+}
+
 int update_stock_quotes(vector<string> tickers, long long st_date, long long ed_date)
 {
-	vector<vector<string>> insert_values;
-	string query = "";
+	string query = "insert into Quotes (Symbol, Date, Open, High, Low, Close, Volume, Adj_Close) values";
+	// a rerun over dates already loaded takes the new prints rather than failing the whole statement
+	string upsert = "on duplicate key update Open=values(Open), High=values(High), Low=values(Low), Close=values(Close), Volume=values(Volume), Adj_Close=values(Adj_Close)";
+	string quarantine_query = "insert into QuoteQuarantine (Symbol, Date, Open, High, Low, Close, Volume, Adj_Close, Reason) values";
+	QuoteValidator validator;
+	MysqlManager *mysql_manager = MysqlManager::get_instance();
+	int row_affected = 0;
 
 	for(int ticker_index = 0; ticker_index < tickers.size(); ++ticker_index)
-        {
+	{
 		int st_year  = st_date/10000;
-                int st_month = (st_date%10000)/100;
-                int st_day   = st_date%100;
-
-                int ed_year  = ed_date/10000;
-                int ed_month = (ed_date%10000)/100;
-                int ed_day   = ed_date%100;
-
-                try{
-                	string response_string = quote::getHistoricalQuotesCsv(tickers[ticker_index],
-                                                                               st_year, st_month, st_day,
-                                                                               ed_year, ed_month, ed_day,
-                                                                               quote::RangeType::daily);
-			stringstream response(response_string);
-				
-			// construct the headers/columns of the table in database, replace the space in header with underscore
-			string headers;
-			getline(response, headers, '\n');
-			replace(headers.begin(), headers.end(), ' ', '_');
-
-			// construct the insert statement: prepare statement + values
-			// prepare statment is only constructed at the first time 
-			if(query=="")
-			{
-				vector<string> headers_list;
-				boost::split(headers_list, headers, boost::is_any_of(","));
-				vector<string> place_holders(headers_list.size(), "?");
-                                query = "insert into Quotes (Symbol," + headers + ") values(?," + boost::algorithm::join(place_holders, ",") + ")";
-			}
-
-			string values;
-			while(getline(response, values, '\n'))
-			{
-				// construct record consist of: symbol, date, open, high, low, close, volume, adjust close
-				vector<string> insert_value;
-				insert_value.push_back(tickers[ticker_index]);
-				vector<string> vals;
-				boost::split(vals, values, boost::is_any_of(","));
-				insert_value.insert(insert_value.end(), vals.begin(), vals.end());
-
-				// add the record to values inserted
-				insert_values.push_back(insert_value);
-			}
-                }catch(const std::exception &exc){
-                        cout << "failed to get quotes for ticker " << tickers[ticker_index] << " because:" << exc.what() << endl;
-                }
-        }
+		int st_month = (st_date%10000)/100;
+		int st_day   = st_date%100;
+
+		int ed_year  = ed_date/10000;
+		int ed_month = (ed_date%10000)/100;
+		int ed_day   = ed_date%100;
+
+		try{
+			string response_string = quote::getHistoricalQuotesCsv(tickers[ticker_index],
+									       st_year, st_month, st_day,
+									       ed_year, ed_month, ed_day,
+									       quote::RangeType::daily);
+			QuoteBatch batch = parse_quotes_csv(tickers[ticker_index], response_string);
+
+			// only clean rows reach Quotes, the rest are kept aside with the reason for a look later
+			vector<QuoteRow> clean;
+			vector<QuarantinedQuoteRow> quarantined;
+			double last_close = batch.size() > 0 && batch.day[0] >= 0 ? last_close_before(tickers[ticker_index], batch.day[0]) : NAN;
+			QuoteQualityStats stats = validator.split(batch, validator.validate(batch, last_close), clean, quarantined);
+			cout << stats.to_string() << endl;
+
+			row_affected += mysql_manager->executeBatchUpdate(query, clean, upsert);
+			if(!quarantined.empty())
+				mysql_manager->executeBatchUpdate(quarantine_query, quarantined);
+		}catch(const std::exception &exc){
+			cout << "failed to get quotes for ticker " << tickers[ticker_index] << " because:" << exc.what() << endl;
+		}
+	}
 
-	MysqlManager *mysql_manager = MysqlManager::get_instance();
-	return mysql_manager->executeUpdate(query, insert_values);
+	return row_affected;
 }
 
 int main(int argc, const char * argv[]) {
@@ -98,25 +150,26 @@ int main(int argc, const char * argv[]) {
 	
         cout << start_date << " to " << end_date << endl;
 
-	// upate stock quotes
+	// daily bars of the range, validated on the way into Quotes
 	auto stock_tickers = get_tickers();
- 	//update_stock_quotes(stock_tickers, start_date, end_date);
+	int row_affected = update_stock_quotes(stock_tickers, start_date, end_date);
+	cout << "update " << row_affected << " quotes" << endl;
 
-	// latest quote
-	try
+	// latest quotes, "poll" as the third argument keeps polling at the configured cadence
+	Configuration *config = Configuration::get_instance();
+	QuotePoller poller(stock_tickers, chrono::seconds(config->quote_poll_seconds), config->quote_batch_size);
+	if(argc > 3 && string(argv[3]) == "poll")
 	{
-		string petr4Quotes = quote::getLatestQuotesCsv("GOOG", {quote::QuoteType::symbol,
-                	                                                quote::QuoteType::name,
-                        	                                        quote::QuoteType::lastTradePriceOnly,
-                                	                                quote::QuoteType::lastTradeDate,
-                                        	                        quote::QuoteType::lastTradeTime});
-		cout << petr4Quotes << endl;
+		poller.start();
+		while(true)
+			this_thread::sleep_for(chrono::hours(1));
 	}
-	catch(const std::exception &exc)
-	{
-		cout << "Failed to download GOOG" << endl;
-	}
-	//cout << tickers.size() << " " << tickers[0] << endl;*/
+
+	poller.fetch(stock_tickers);
+	CachedQuote latest;
+	for(auto it = stock_tickers.begin(); it != stock_tickers.end(); ++it)
+		if(QuoteCache::get_instance()->get(*it, latest))
+			cout << *it << " " << latest.price << " " << latest.trade_time << endl;
 	
 	cout << "finish" << endl;
 
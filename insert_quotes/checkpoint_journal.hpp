@@ -0,0 +1,194 @@
+#ifndef CHECKPOINT_JOURNAL_HPP
+#define CHECKPOINT_JOURNAL_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Append only journal of how far each ticker's history file has been committed to the db.
+// Every line is "<ticker> <offset>", "<ticker> chunk <begin> <end>" or "<ticker> done", the last offset of a
+// ticker wins. Chunks commit out of order: the offset is the contiguous committed prefix of a file, a line
+// start that is safe to resume from, and chunks committed beyond it are recorded one by one so a resumed
+// run skips them and only redoes the chunks that were in flight.
+class CheckpointJournal
+{
+private:
+	struct Progress
+	{
+		size_t committed; // everything before this offset is in the db
+		size_t file_size;
+		bool read_finished;
+		map<size_t, size_t> pending; // committed chunks beyond the watermark, begin -> end
+	};
+
+	string file_name;
+	int fd;
+	mutex mtx;
+	unordered_map<string, size_t> offsets; // loaded from the previous runs
+	unordered_map<string, map<size_t, size_t>> chunks; // committed beyond the offset in the previous runs, begin -> end
+	unordered_map<string, bool> finished;
+	unordered_map<string, Progress> progress;
+
+	void append(string line)
+	{
+		line += "\n";
+		if(write(fd, line.c_str(), line.size()) != (ssize_t)line.size() || fsync(fd) != 0)
+			cout << "fail to write checkpoint: " << line;
+	}
+
+	// move the watermark over the committed chunks that now follow it, true if it moved
+	static bool advance(Progress &p)
+	{
+		size_t watermark = p.committed;
+		for(auto chunk = p.pending.begin(); chunk != p.pending.end() && chunk->first <= watermark; chunk = p.pending.erase(chunk))
+			watermark = max(watermark, chunk->second);
+
+		if(watermark == p.committed)
+			return false;
+
+		p.committed = watermark;
+		return true;
+	}
+
+	void finish_if_complete(const string &ticker, Progress &p)
+	{
+		if(p.read_finished && p.committed >= p.file_size)
+		{
+			append(ticker + " done");
+			finished[ticker] = true;
+			progress.erase(ticker);
+		}
+	}
+
+public:
+	CheckpointJournal(string file_name):file_name(file_name)
+	{
+		ifstream journal(file_name);
+		string line;
+		while(getline(journal, line))
+		{
+			stringstream ss(line);
+			string ticker, offset;
+			if(!(ss >> ticker >> offset))
+				continue; // torn last line of a crashed run
+
+			size_t begin, end;
+			if(offset == "done")
+				finished[ticker] = true;
+			else if(offset == "chunk")
+			{
+				if(ss >> begin >> end)
+					chunks[ticker][begin] = end;
+			}
+			else if(offset.find_first_not_of("0123456789") == string::npos)
+				offsets[ticker] = stoull(offset);
+		}
+
+		fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if(fd < 0)
+			throw runtime_error("can not open checkpoint journal " + file_name);
+	}
+
+	bool done(string ticker)
+	{
+		lock_guard<mutex> lock(mtx);
+		return finished.count(ticker) > 0;
+	}
+
+	// offset to resume the ticker from, 0 if it was never started
+	size_t offset(string ticker)
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = offsets.find(ticker);
+		return it == offsets.end() ? 0 : it->second;
+	}
+
+	// chunks of the ticker a previous run committed past its offset, begin -> end, for the reader to skip
+	map<size_t, size_t> committed_chunks(string ticker)
+	{
+		lock_guard<mutex> lock(mtx);
+		map<size_t, size_t> committed;
+		auto it = chunks.find(ticker);
+		auto offset = offsets.find(ticker);
+		if(it != chunks.end())
+			for(auto chunk = it->second.begin(); chunk != it->second.end(); ++chunk)
+				if(offset == offsets.end() || chunk->first >= offset->second)
+					committed.insert(*chunk);
+
+		return committed;
+	}
+
+	// the ticker is read again from start_offset, the chunks previous runs committed past it count as done
+	void start(string ticker, size_t start_offset)
+	{
+		lock_guard<mutex> lock(mtx);
+		Progress &p = progress[ticker];
+		p.committed = start_offset;
+		p.file_size = 0;
+		p.read_finished = false;
+
+		auto it = chunks.find(ticker);
+		if(it != chunks.end())
+			for(auto chunk = it->second.begin(); chunk != it->second.end(); ++chunk)
+				if(chunk->first >= start_offset)
+					p.pending.insert(*chunk);
+
+		if(advance(p))
+		{
+			offsets[ticker] = p.committed;
+			append(ticker + " " + to_string(p.committed));
+		}
+	}
+
+	// all chunks of the file have been handed to the writers
+	void read_finished(string ticker, size_t file_size)
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = progress.find(ticker);
+		if(it == progress.end())
+			return;
+
+		it->second.file_size = file_size;
+		it->second.read_finished = true;
+		finish_if_complete(ticker, it->second);
+	}
+
+	// the chunk [begin, end) of ticker is committed, advance the watermark as far as possible or record the chunk
+	void commit(string ticker, size_t begin, size_t end)
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = progress.find(ticker);
+		if(it == progress.end())
+			return;
+
+		Progress &p = it->second;
+		p.pending[begin] = end;
+
+		if(advance(p))
+		{
+			offsets[ticker] = p.committed;
+			append(ticker + " " + to_string(p.committed));
+		}
+		else
+			append(ticker + " chunk " + to_string(begin) + " " + to_string(end));
+
+		finish_if_complete(ticker, p);
+	}
+
+	~CheckpointJournal()
+	{
+		close(fd);
+	}
+};
+
+#endif
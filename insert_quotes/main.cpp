@@ -1,14 +1,12 @@
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include "quote.hpp"
 #include "mysql.hpp"
-#include <sstream>
-#include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/join.hpp>
-#include <boost/range/iterator_range.hpp>
+#include "blocking_queue.hpp"
+#include "option_chain_reader.hpp"
+#include "checkpoint_journal.hpp"
 #include <ctime>
 #include <thread>
 #include <memory>
@@ -16,6 +14,8 @@ using namespace std;
 
 int nThread = 120;
 string base_dir = "/home/lishuo/Desktop/OptionChain_all/";
+string journal_file = "insert_option_chain.journal"; // delete it to load everything again
+size_t chunk_size = 1 << 20; // unit of commit, a crash costs the chunks in flight, at most one per writer; keep it across resumes
 
 vector<string> get_tickers()
 {
@@ -32,47 +32,43 @@ vector<string> get_tickers()
 	return tickers;
 }
 
-int insert_option_chain(string ticker)
+// db writers, each one owns a connection and drains parsed chunks until the queue is closed.
+// A chunk is committed in one transaction and upserted on the primary key, so replaying it after a crash is harmless.
+void write_option_chunks(BlockingQueue<OptionChunk> *chunks, CheckpointJournal *journal)
 {
-	vector<vector<string>> insert_values;
-	string query = "insert into HistoricalOptionChain (ticker, type, underlyingPrice, mid, pricingDate, strike, expiration) values(?,?,?,?,?,?,?)";
+	string query = "insert into HistoricalOptionChain (ticker, type, underlyingPrice, mid, pricingDate, strike, expiration) values";
+	string upsert = "on duplicate key update underlyingPrice=values(underlyingPrice), mid=values(mid)";
+	unique_ptr<MysqlManager> mysql_manager(new MysqlManager());
 
-        try{
-		string file_name = base_dir + ticker;
-
-		ifstream file(file_name);
-		if(file.is_open())
-		{
-			string line;
-			vector<string> vals;
-			while(getline(file, line))
-			{
-				vector<string> insert_val ={ticker};
-				boost::split(vals,line,boost::is_any_of("/"));
-				insert_val.insert(insert_val.end(), vals.begin() + 1, vals.end());
-				insert_values.push_back(insert_val);
-			}
-		}
-
-        }catch(const std::exception &exc){
-                cout << "failed to get quotes for ticker " << ticker << " because:" << exc.what() << endl;
-        }
-
-	vector<thread> threads;
-	int blockSize = insert_values.size()/nThread;
-	for(int i = 0; i < nThread - 1; ++i)
+	OptionChunk chunk;
+	while(chunks->pop(chunk))
 	{
-		vector<vector<string>> block(insert_values.begin() + i*blockSize, insert_values.begin() + (i+1)*blockSize);
-		threads.push_back(thread(&MysqlManager::executeUpdate, unique_ptr<MysqlManager>(new MysqlManager()), query, block));
+		if(mysql_manager->executeBatchUpdateAtomically(query, chunk.records, upsert) >= 0)
+			journal->commit(chunk.ticker, chunk.begin, chunk.end);
+		else
+			cout << "chunk [" << chunk.begin << ", " << chunk.end << ") of " << chunk.ticker << " is left for the next run" << endl;
 	}
-	
-	vector<vector<string>> last_block(insert_values.begin()+(nThread - 1)*blockSize, insert_values.end());
-	threads.push_back(thread(&MysqlManager::executeUpdate, unique_ptr<MysqlManager>(new MysqlManager()), query, last_block));
+}
 
-	for(auto it = threads.begin(); it != threads.end(); ++it)
-		it->join();
+int insert_option_chain(string ticker, BlockingQueue<OptionChunk> &chunks, CheckpointJournal &journal)
+{
+	if(journal.done(ticker))
+		return 0;
+
+	try{
+		size_t start_offset = journal.offset(ticker);
+		if(start_offset > 0)
+			cout << "resume " << ticker << " from offset " << start_offset << endl;
 
-	cout << "finish insert for " << ticker << endl;
+		map<size_t, size_t> committed = journal.committed_chunks(ticker);
+		journal.start(ticker, start_offset);
+		OptionChainReader reader(base_dir + ticker, ticker, chunk_size);
+		size_t n_record = reader.read(chunks, start_offset, committed);
+		journal.read_finished(ticker, reader.size());
+		cout << "finish reading " << n_record << " records for " << ticker << endl;
+	}catch(const std::exception &exc){
+		cout << "failed to get quotes for ticker " << ticker << " because:" << exc.what() << endl;
+	}
 
 	return 0;
 }
@@ -82,8 +78,19 @@ int main(int argc, const char * argv[]) {
 	//vector<string> tickers_subset(tickers.begin(), tickers.begin()+50);
 	time_t st = time(0);   // get time now
 	
+	// parsers of one ticker keep the writers busy while the next file is mapped
+	CheckpointJournal journal(journal_file);
+	BlockingQueue<OptionChunk> chunks(2 * nThread);
+	vector<thread> writers;
+	for(int i = 0; i < nThread; ++i)
+		writers.push_back(thread(write_option_chunks, &chunks, &journal));
+
 	for(auto it = tickers.begin(); it != tickers.end(); ++it)
-		insert_option_chain(*it);
+		insert_option_chain(*it, chunks, journal);
+
+	chunks.close();
+	for(auto it = writers.begin(); it != writers.end(); ++it)
+		it->join();
 	
 	time_t ed = time(0);
 
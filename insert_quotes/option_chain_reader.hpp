@@ -0,0 +1,276 @@
+#ifndef OPTION_CHAIN_READER_HPP
+#define OPTION_CHAIN_READER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "option_record.hpp"
+#include "blocking_queue.hpp"
+
+using namespace std;
+
+// records parsed from the byte range [begin, end) of a history file
+struct OptionChunk
+{
+	string ticker;
+	size_t begin;
+	size_t end;
+	vector<OptionRecord> records;
+	size_t malformed_lines;
+};
+
+// read only view of a whole file, unmapped on destruction
+class MappedFile
+{
+private:
+	int fd;
+	const char *data;
+	size_t length;
+
+public:
+	MappedFile(string file_name):fd(-1),data(NULL),length(0)
+	{
+		fd = open(file_name.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw runtime_error("can not open " + file_name);
+
+		struct stat st;
+		if(fstat(fd, &st) < 0)
+		{
+			close(fd);
+			throw runtime_error("can not stat " + file_name);
+		}
+
+		length = st.st_size;
+		if(length > 0)
+		{
+			void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(addr == MAP_FAILED)
+			{
+				close(fd);
+				throw runtime_error("can not mmap " + file_name);
+			}
+
+			madvise(addr, length, MADV_SEQUENTIAL);
+			data = (const char*)addr;
+		}
+	}
+
+	const char* begin() const { return data; }
+	size_t size() const { return length; }
+
+	~MappedFile()
+	{
+		if(data)
+			munmap((void*)data, length);
+		if(fd >= 0)
+			close(fd);
+	}
+};
+
+// Each line of an option chain history file is
+//   <id>/<type>/<underlyingPrice>/<mid>/<pricingDate>/<strike>/<expiration>
+// The file is mmapped, cut into newline aligned chunks and the chunks are parsed by a pool of threads.
+// Every parsed chunk is handed to the sink as soon as it is ready, so db writers start before the file is finished.
+class OptionChainReader
+{
+private:
+	string file_name;
+	string ticker;
+	size_t chunk_size;
+	int n_parser;
+	size_t file_size;
+
+	// decimal number in [b, e), fast path for plain "-123.456", falls back to strtod otherwise
+	static bool parse_double(const char *b, const char *e, double &val)
+	{
+		static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+					       1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+		const char *p = b;
+		bool negative = false;
+		if(p < e && (*p == '-' || *p == '+'))
+			negative = (*p++ == '-');
+
+		unsigned long long mantissa = 0;
+		int digits = 0, frac_digits = 0;
+		bool after_dot = false;
+		for(; p < e; ++p)
+		{
+			if(*p >= '0' && *p <= '9')
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				++digits;
+				if(after_dot)
+					++frac_digits;
+			}
+			else if(*p == '.' && !after_dot)
+				after_dot = true;
+			else
+				break;
+		}
+
+		if(p == e && digits > 0 && digits <= 18)
+		{
+			val = (double)mantissa / pow10[frac_digits];
+			if(negative)
+				val = -val;
+			return true;
+		}
+
+		// exponent, nan, too many digits... let the c library deal with it
+		string field(b, e);
+		char *end_ptr;
+		val = strtod(field.c_str(), &end_ptr);
+		return !field.empty() && *end_ptr == '\0';
+	}
+
+	void parse_line(const char *b, const char *e, OptionChunk &chunk)
+	{
+		if(e > b && *(e - 1) == '\r')
+			--e;
+		if(b == e)
+			return;
+
+		// split on '/', the first field is a row id which is not stored
+		const char *fields[8];
+		const char *fields_end[8];
+		int n_field = 0;
+		const char *field_begin = b;
+		for(const char *p = b; p <= e && n_field < 8; ++p)
+		{
+			if(p == e || *p == '/')
+			{
+				fields[n_field] = field_begin;
+				fields_end[n_field] = p;
+				++n_field;
+				field_begin = p + 1;
+			}
+		}
+
+		OptionRecord record;
+		if(n_field != 7
+		   || !parse_double(fields[2], fields_end[2], record.underlyingPrice)
+		   || !parse_double(fields[3], fields_end[3], record.mid)
+		   || !parse_double(fields[5], fields_end[5], record.strike))
+		{
+			++chunk.malformed_lines;
+			return;
+		}
+
+		record.ticker = ticker;
+		record.type.assign(fields[1], fields_end[1]);
+		record.pricingDate.assign(fields[4], fields_end[4]);
+		record.expiration.assign(fields[6], fields_end[6]);
+		chunk.records.push_back(move(record));
+	}
+
+	void parse_chunk(const char *data, size_t begin, size_t end, OptionChunk &chunk)
+	{
+		chunk.ticker = ticker;
+		chunk.begin = begin;
+		chunk.end = end;
+		chunk.malformed_lines = 0;
+		chunk.records.reserve((end - begin) / 48);
+
+		const char *p = data + begin;
+		const char *chunk_end = data + end;
+		while(p < chunk_end)
+		{
+			const char *line_end = (const char*)memchr(p, '\n', chunk_end - p);
+			if(!line_end)
+				line_end = chunk_end;
+
+			parse_line(p, line_end, chunk);
+			p = line_end + 1;
+		}
+	}
+
+	// chunk boundaries, every boundary except the file end sits just after a newline
+	vector<size_t> split(const char *data, size_t length, size_t start_offset)
+	{
+		vector<size_t> bounds(1, start_offset);
+		size_t pos = start_offset;
+		while(length - pos > chunk_size)
+		{
+			const char *nl = (const char*)memchr(data + pos + chunk_size, '\n', length - pos - chunk_size);
+			if(!nl)
+				break;
+
+			pos = nl - data + 1;
+			bounds.push_back(pos);
+		}
+
+		if(bounds.back() != length)
+			bounds.push_back(length);
+
+		return bounds;
+	}
+
+public:
+	OptionChainReader(string file_name, string ticker, size_t chunk_size = 1 << 22, int n_parser = thread::hardware_concurrency())
+		:file_name(file_name),ticker(ticker),chunk_size(chunk_size),n_parser(n_parser > 0 ? n_parser : 1),file_size(0){}
+
+	// parse the file from start_offset (a line start) and push every chunk into sink, return the number of records.
+	// Chunks inside a range of skip (begin -> end, committed by an earlier run) are left out.
+	size_t read(BlockingQueue<OptionChunk> &sink, size_t start_offset = 0, const map<size_t, size_t> &skip = map<size_t, size_t>())
+	{
+		MappedFile file(file_name);
+		file_size = file.size();
+		if(start_offset >= file.size())
+			return 0;
+
+		vector<size_t> bounds = split(file.begin(), file.size(), start_offset);
+		size_t n_chunk = bounds.size() - 1;
+
+		// the bounds are cut the same way from any bound, so chunks of an earlier run from further back line up
+		vector<bool> skipped(n_chunk, false);
+		for(size_t i = 0; i < n_chunk; ++i)
+		{
+			auto range = skip.upper_bound(bounds[i]);
+			skipped[i] = range != skip.begin() && (--range)->second >= bounds[i + 1];
+		}
+
+		atomic<size_t> next_chunk(0);
+		atomic<size_t> n_record(0);
+		vector<thread> parsers;
+		for(int i = 0; i < n_parser && i < (int)n_chunk; ++i)
+		{
+			parsers.push_back(thread([&]{
+				size_t chunk_index;
+				while((chunk_index = next_chunk++) < n_chunk)
+				{
+					if(skipped[chunk_index])
+						continue;
+
+					OptionChunk chunk;
+					parse_chunk(file.begin(), bounds[chunk_index], bounds[chunk_index + 1], chunk);
+					if(chunk.malformed_lines > 0)
+						cout << "skip " << chunk.malformed_lines << " malformed lines in " << file_name << endl;
+
+					n_record += chunk.records.size();
+					sink.push(move(chunk));
+				}
+			}));
+		}
+
+		for(auto it = parsers.begin(); it != parsers.end(); ++it)
+			it->join();
+
+		return n_record;
+	}
+
+	// size of the file at the last read
+	size_t size() const { return file_size; }
+};
+
+#endif
@@ -4,35 +4,201 @@ $(document).ready(function(){
 	* web socket for initilization
 	*/
 	var init_ws = new WebSocket("ws://localhost:9002");
+	init_ws.binaryType = "arraybuffer";
 
 	init_ws.onopen = function()
 	{
+		// charts and deal tables come back as binary frames, see init_end_point.hpp for the layout
+		sendRequests(init_ws, ['wire_format binary']);
+		searchTickers('');
 	};
 
+	/*
+	* requests go out as "#<id> request" lines, several per frame, and replies come back as "#<id> reply"
+	* in whatever order the server finishes them. Pushed updates carry no id.
+	*/
+	var next_request_id = 1;
+
+	function sendRequests(ws, requests) {
+		var lines = [];
+		var ids = [];
+		for (var i = 0; i < requests.length; i++) {
+			ids.push(next_request_id);
+			lines.push('#' + next_request_id + ' ' + requests[i]);
+			next_request_id++;
+		}
+
+		ws.send(lines.join('\n'));
+		return ids;
+	}
+
+	// {id: request id or 0, msg: the decoded reply}
+	function parseReply(data) {
+		if (data instanceof ArrayBuffer) {
+			var frame = decodeBinaryFrame(data);
+			return {id: frame.request_id, msg: frame};
+		}
+
+		if (data.charAt(0) === '#') {
+			var space = data.indexOf(' ');
+			return {id: parseInt(data.substring(1, space), 10), msg: JSON.parse(data.substring(space + 1))};
+		}
+
+		return {id: 0, msg: JSON.parse(data)};
+	}
+
+	var little_endian = new Uint8Array(new Uint32Array([1]).buffer)[0] === 1;
+
+	function align8(offset) {
+		return (offset + 7) & ~7;
+	}
+
+	// columns are little-endian and 8 byte aligned, view them in place when the browser is little-endian too
+	function readColumn(buffer, view, offset, n, type) {
+		if (little_endian)
+			return new type(buffer, offset, n);
+
+		var column = new type(n);
+		for (var i = 0; i < n; i++) {
+			if (type === Float64Array)
+				column[i] = view.getFloat64(offset + 8 * i, true);
+			else if (type === Int32Array)
+				column[i] = view.getInt32(offset + 4 * i, true);
+			else
+				column[i] = view.getUint32(offset + 4 * i, true);
+		}
+		return column;
+	}
+
+	function readString(bytes, offset, length) {
+		var s = '';
+		for (var i = 0; i < length; i++)
+			s += String.fromCharCode(bytes[offset + i]);
+		return s;
+	}
+
+	function decodeBinaryFrame(buffer) {
+		var view = new DataView(buffer);
+		var bytes = new Uint8Array(buffer);
+		var type = view.getUint8(1);
+		var name_length = view.getUint16(2, true);
+		var name = readString(bytes, 4, name_length);
+		var offset = 4 + name_length;
+		var request_id = view.getUint32(offset, true);
+		var n = view.getUint32(offset + 4, true);
+		offset = align8(offset + 8);
+
+		if (type === 1 || type === 3) { // quotes, or only the bars after the date asked for
+			var day = readColumn(buffer, view, offset, n, Int32Array); offset = align8(offset + 4 * n);
+			var open = readColumn(buffer, view, offset, n, Float64Array); offset += 8 * n;
+			var high = readColumn(buffer, view, offset, n, Float64Array); offset += 8 * n;
+			var low = readColumn(buffer, view, offset, n, Float64Array); offset += 8 * n;
+			var close = readColumn(buffer, view, offset, n, Float64Array);
+
+			var data = new Array(n);
+			for (var i = 0; i < n; i++)
+				data[i] = [day[i] * 86400000, open[i], high[i], low[i], close[i]];
+
+			if (type === 3)
+				return {request_id: request_id, ticker: name, chart_tail: data};
+			return {request_id: request_id, ticker: name, chart_data: data};
+		}
+
+		if (type === 2) { // deals
+			var n_tickers = view.getUint32(offset, true);
+			offset += 4;
+			var tickers = [];
+			for (var t = 0; t < n_tickers; t++) {
+				var length = view.getUint16(offset, true);
+				tickers.push(readString(bytes, offset + 2, length));
+				offset += 2 + length;
+			}
+			offset = align8(offset);
+
+			var ticker = readColumn(buffer, view, offset, n, Uint32Array); offset = align8(offset + 4 * n);
+			var customer_book = readColumn(buffer, view, offset, n, Int32Array); offset = align8(offset + 4 * n);
+			var deal_day = readColumn(buffer, view, offset, n, Int32Array); offset = align8(offset + 4 * n);
+			var quantity = readColumn(buffer, view, offset, n, Float64Array);
+
+			var deals = new Array(n);
+			for (var i = 0; i < n; i++)
+				deals[i] = {customer_book: customer_book[i], ticker: tickers[ticker[i]], quantity: quantity[i], date: new Date(deal_day[i] * 86400000).toISOString().substring(0, 10)};
+
+			return {request_id: request_id, book_id: name, deals: deals};
+		}
+
+		return {request_id: request_id};
+	}
+
+	var chart_request_id = null; // only the chart asked for last is drawn, earlier replies may still arrive
+	var chart_ticker = null;
+	var chart_bars = {}; // by ticker, what was received so far, so showing a ticker again only asks for newer bars
+
 	init_ws.onmessage = function (evt)
 	{
-		var msg = JSON.parse(evt.data);
+		var reply = parseReply(evt.data);
+		var msg = reply.msg;
 
-		if(msg.hasOwnProperty("deals"))
+		if(msg.hasOwnProperty("deals") && msg.hasOwnProperty("page") && (deals_book_id === null || msg.book_id == deals_book_id))
                 {
-			$('#deals_table tr').remove();
+			deal_rows = msg.deals;
+			deal_page.page = msg.page;
+			deal_page.total = msg.total;
+			showDeals();
+		}
+
+		// we fell behind on the book we follow, ask for our page again
+		if(msg.hasOwnProperty("deals_changed") && msg.deals_changed.book_id == deals_book_id)
+			requestDealPage();
 
-	                var deals = msg.deals;
-        	        var deals_as_string = '';
+		// deal rows trades landed in for the book we follow, updated in place when they are on the page, else
+		// the page is asked for again as the trades may have moved rows across pages
+		if(msg.hasOwnProperty("deal_updates"))
+		{
+			var all_shown = msg.deal_updates.length > 0;
+			var in_place = deal_page.sort.replace('-', '') != 'quantity'; // a new quantity may belong on another page
+			for (var d = 0; d < msg.deal_updates.length; d++)
+			{
+				var deal = msg.deal_updates[d];
+				var shown = false;
+				for (i = 0; i < deal_rows.length && in_place && deal.book_id == deals_book_id; i++)
+					if (deal_rows[i].customer_book == deal.customer_book && deal_rows[i].ticker == deal.ticker) {
+						deal_rows[i] = deal;
+						shown = true;
+					}
+				all_shown = all_shown && shown;
+			}
 
-                	for (i = 0; i < deals.length; i++) 
-                        	deals_as_string += '<tr><td>' + deals[i].ticker + '</td><td>' + deals[i].quantity + '</td><td>' + deals[i].date + '</td><tr>';
+			if (msg.deal_updates.length > 0 && msg.deal_updates[0].book_id == deals_book_id)
+			{
+				if (all_shown)
+					showDeals();
+				else
+					requestDealPage();
+			}
+		}
 
-        	        $('#deals_table tbody').append(deals_as_string);
+		if(msg.hasOwnProperty("positions_update"))
+		{
+			var update = msg.positions_update;
+			if(update.book_id == deals_book_id)
+			{
+				if(update.snapshot)
+					position_rows = {};
+				for (i = 0; i < update.positions.length; i++)
+					position_rows[update.positions[i].ticker] = update.positions[i];
+
+				showPositions();
+			}
 		}
 
 
-		if(msg.hasOwnProperty("tickers"))
+		if(msg.hasOwnProperty("ticker_search") && reply.id === search_request_id)
 	       	{
-			var tickers = msg.tickers;
+			var results = msg.ticker_search.results;
 			var optionsAsString = "";
-			for(var i = 0; i < tickers.length; i++) {
-			    optionsAsString += "<option value='" + tickers[i] + "'>" + tickers[i] + "</option>";
+			for(var i = 0; i < results.length; i++) {
+			    optionsAsString += "<option value='" + results[i].symbol + "'>" + results[i].symbol + " - " + $('<div>').text(results[i].name).html() + "</option>";
 			}
 
 			$("#tickers_select").empty().append(optionsAsString);
@@ -65,21 +231,30 @@ $(document).ready(function(){
                         }
 
                         $("#customer_books_select").empty().append(customer_book_options);
+
+			followBook($.trim($("#trading_books_for_deals_select").find(":selected").val()));
                 }		
 
-		if(msg.hasOwnProperty("quotes"))
+		if(msg.hasOwnProperty("chart_data") && reply.id === chart_request_id)
+		{
+			chart_bars[msg.ticker] = msg.chart_data.slice(); // the charts keep the array they are given
+			CreatePriceChart(msg.ticker, msg.chart_data);
+			CreatePriceChartWithTrend(msg.ticker, msg.chart_data);
+		}
+
+		if(msg.hasOwnProperty("chart_tail") && reply.id === chart_request_id)
+			appendBars(msg.ticker, msg.chart_tail);
+
+		if(msg.hasOwnProperty("quotes") && reply.id === chart_request_id)
 		{
 			var ticker = msg.ticker;
 			var quotes = msg.quotes;
-			dateParts = quotes[0].date.split('-'),
-			date = new Date(dateParts[0], parseInt(dateParts[1], 10) - 1, dateParts[2]);
 			
 			var data = [];
 			for (i = 0; i < quotes.length; i++) {
 				dateParts = quotes[i].date.split('-'); // date format is yyyy-mm-dd
-	                        date = new Date(dateParts[0], parseInt(dateParts[1], 10) - 1, dateParts[2]);
                 		data.push([
-                    			date.getTime(),
+                    			Date.UTC(dateParts[0], parseInt(dateParts[1], 10) - 1, dateParts[2]), // as the binary frames have it
                     			parseFloat(quotes[i].open) ,
                     			parseFloat(quotes[i].high) ,
                     			parseFloat(quotes[i].low) ,
@@ -87,8 +262,14 @@ $(document).ready(function(){
                     		]);
             		}
 
-			CreatePriceChart(ticker, data);
-			CreatePriceChartWithTrend(ticker, data);	
+			if(msg.hasOwnProperty("since"))
+				appendBars(ticker, data);
+			else
+			{
+				chart_bars[ticker] = data.slice();
+				CreatePriceChart(ticker, data);
+				CreatePriceChartWithTrend(ticker, data);
+			}
 		}
 			
 	};
@@ -97,12 +278,133 @@ $(document).ready(function(){
 	{
 	};
 
+	// deals and positions of the book shown, kept current by the server pushing updates. Deals come a page
+	// at a time, sorted and filtered by the server.
+	var deals_book_id = null;
+	var deal_rows = [];
+	var deal_page = {page: 0, page_size: 50, sort: 'ticker', ticker: '', total: 0};
+	var position_rows = {};
+
+	function dealPageArgs() {
+		return deals_book_id + ' ' + deal_page.page + ' ' + deal_page.page_size + ' ' + deal_page.sort + (deal_page.ticker ? ' ' + deal_page.ticker : '');
+	}
+
+	function requestDealPage() {
+		if (deals_book_id !== null)
+			init_ws.send('book_id_for_deals ' + dealPageArgs());
+	}
+
+	function followBook(book_id) {
+		var requests = [];
+		if (deals_book_id !== null)
+			requests.push('unsubscribe deals:' + deals_book_id, 'unsubscribe positions:' + deals_book_id);
+
+		deals_book_id = book_id;
+		deal_page.page = 0;
+		position_rows = {};
+		requests.push('subscribe_deals ' + dealPageArgs(), 'subscribe_positions ' + book_id);
+		sendRequests(init_ws, requests);
+	}
+
+	function showDeals() {
+		var deals_as_string = '';
+		for (var i = 0; i < deal_rows.length; i++)
+			deals_as_string += '<tr><td>' + deal_rows[i].ticker + '</td><td>' + deal_rows[i].quantity + '</td><td>' + deal_rows[i].date + '</td><tr>';
+
+		$('#deals_table tbody').empty().append(deals_as_string);
+
+		var pages = Math.max(1, Math.ceil(deal_page.total / deal_page.page_size));
+		$('#deal_page_label').text('page ' + (deal_page.page + 1) + ' of ' + pages + ', ' + deal_page.total + ' deals');
+		$('#deal_page_prev').prop('disabled', deal_page.page === 0);
+		$('#deal_page_next').prop('disabled', deal_page.page + 1 >= pages);
+	}
+
+	$('#deal_page_prev').click(function(){
+		if (deal_page.page > 0) {
+			deal_page.page--;
+			requestDealPage();
+		}
+	});
+
+	$('#deal_page_next').click(function(){
+		deal_page.page++;
+		requestDealPage();
+	});
+
+	// a click on a column header sorts by it, a second click turns the order around
+	$('#deals_table th[data-sort]').click(function(){
+		var key = $(this).data('sort');
+		deal_page.sort = deal_page.sort === key ? '-' + key : key;
+		deal_page.page = 0;
+		requestDealPage();
+	});
+
+	$('#deal_ticker_filter').change(function(){
+		deal_page.ticker = $.trim($(this).val()).toUpperCase();
+		deal_page.page = 0;
+		requestDealPage();
+	});
+
+	function showPositions() {
+		var positions_as_string = '';
+		for (var ticker in position_rows) {
+			var position = position_rows[ticker];
+			positions_as_string += '<tr><td>' + ticker + '</td><td>' + position.quantity + '</td><td>' +
+				(position.hasOwnProperty("price") ? position.price : '') + '</td><td>' +
+				(position.hasOwnProperty("market_value") ? position.market_value.toFixed(2) : '') + '</td><tr>';
+		}
+
+		$('#positions_table tbody').empty().append(positions_as_string);
+	}
+
+	// the server keeps the ticker list, only the best matches of what is typed come over
+	var search_request_id = null;
+
+	function searchTickers(query) {
+		search_request_id = sendRequests(init_ws, ['search_tickers ' + query])[0];
+	}
+
+	$("#ticker_search").on("input", function(){
+		searchTickers($.trim($(this).val()));
+	})
+
+	// a ticker charted before is drawn right away and only the bars after its last one are asked for
 	$("#tickers_select").change(function(){
-                init_ws.send('ticker_for_chart ' + $.trim($(this).find(":selected").text()));
+		chart_ticker = $(this).find(":selected").val();
+		var request = 'ticker_for_chart ' + chart_ticker;
+		var bars = chart_bars[chart_ticker];
+		if (bars && bars.length > 0) {
+			CreatePriceChart(chart_ticker, bars.slice());
+			CreatePriceChartWithTrend(chart_ticker, bars.slice());
+			request += ' ' + new Date(bars[bars.length - 1][0]).toISOString().substring(0, 10);
+		}
+
+                chart_request_id = sendRequests(init_ws, [request])[0];
         })
 
+	function appendBars(ticker, tail) {
+		var bars = chart_bars[ticker];
+		if (!bars)
+			return;
+
+		var charts = ticker === chart_ticker ? [$("#price_chart").highcharts(), $("#price_chart_with_trend").highcharts()] : [];
+		for (var i = 0; i < tail.length; i++) {
+			if (bars.length > 0 && tail[i][0] <= bars[bars.length - 1][0])
+				continue;
+
+			bars.push(tail[i]);
+			for (var c = 0; c < charts.length; c++)
+				if (charts[c])
+					charts[c].series[0].addPoint(tail[i], false);
+		}
+
+		for (var c = 0; c < charts.length; c++)
+			if (charts[c])
+				charts[c].redraw();
+	}
+
 	$("#trading_books_for_deals_select").change(function(){
-                init_ws.send('book_id_for_deals ' + $.trim($(this).find(":selected").val()));
+                followBook($.trim($(this).find(":selected").val()));
         })
 
 
@@ -160,12 +462,20 @@ $(document).ready(function(){
 
 	booking_ws.onmessage = function (evt)
         {
-		// if the trade book into the book that currently showing, book id sent to server and deals table get refresh
-		if($('#trading_books_select').find(":selected").val() == $('#trading_books_for_deals_select').find(":selected").val())
-			init_ws.send('book_id_for_deals ' + $.trim($("#trading_books_for_deals_select").find(":selected").val()));
-
-		var n_trades_inserted = evt.data;
-		$('#booking_feedback').text('trade inserted into database');
+		// deals, positions and risk of the book follow through the subscriptions
+		var msg = parseReply(evt.data).msg;
+		var feedback;
+		if (msg !== null && msg.hasOwnProperty("basket")) {
+			var basket = msg.basket;
+			feedback = basket.booked ? basket.trades + ' trades booked' : 'portfolio was not booked';
+			for (var i = 0; i < basket.errors.length && i < 5; i++)
+				feedback += (i ? ', ' : ': ') + (basket.errors[i].line ? 'line ' + basket.errors[i].line + ' ' : '') + basket.errors[i].error;
+		}
+		else if (msg !== null && msg.hasOwnProperty("error_msg"))
+			feedback = 'trade was not booked: ' + msg.error_msg;
+		else
+			feedback = msg > 0 ? 'trade inserted into database' : 'trade was not booked';
+		$('#booking_feedback').text(feedback);
 		$('#booking_feedback').show();
 		$('#booking_feedback').fadeOut(2500);
 	}
@@ -180,7 +490,7 @@ $(document).ready(function(){
 
 		var trading_book = $('#trading_books_select').find(":selected").val();
 		var customer_book = $('#customer_books_select').find(":selected").val();
-		var ticker = $('#tickers_select').find(":selected").text();
+		var ticker = $('#tickers_select').find(":selected").val();
 
 		var today = new Date();
 		var month = today.getMonth()+1;
@@ -190,7 +500,31 @@ $(document).ready(function(){
     		(month<10 ? '0' : '') + month + '-' +
     		(day<10 ? '0' : '') + day;
 
-		booking_ws.send(trading_book + " " + customer_book + " " + ticker + " " + quantity + " " + date);
+		sendRequests(booking_ws, [trading_book + " " + customer_book + " " + ticker + " " + quantity + " " + date]);
+	});
+
+	// one line per trade, "trading_book,customer_book,ticker,quantity,date" (commas or spaces), booked as
+	// one basket: all lines or none
+	$('#portfolio_file').change(function() {
+		var file = this.files[0];
+		if (!file)
+			return;
+
+		var reader = new FileReader();
+		reader.onload = function() {
+			var trades = [];
+			var lines = reader.result.split(/\r?\n/);
+			for (var i = 0; i < lines.length; i++) {
+				var line = $.trim(lines[i].replace(/,/g, ' ').replace(/;/g, ' '));
+				if (line.length > 0)
+					trades.push(line.replace(/\s+/g, ' '));
+			}
+
+			if (trades.length > 0)
+				sendRequests(booking_ws, ['basket ' + trades.join(';')]);
+		};
+		reader.readAsText(file);
+		$(this).val('');
 	});
 
 	function isNumeric(n) {
@@ -202,10 +536,11 @@ $(document).ready(function(){
 	* web socket for risk report
 	*/
 	var risk_report_ws = new WebSocket("ws://localhost:9004");
+	var risk_topic = null;
 
         risk_report_ws.onmessage = function (evt)
         {
-		var msg = JSON.parse(evt.data);
+		var msg = parseReply(evt.data).msg;
                 if(msg.hasOwnProperty("risk_reports"))
                 {
                         var risk_reports = msg.risk_reports;
@@ -216,6 +551,21 @@ $(document).ready(function(){
 
                         $("#risk_report_select").empty().append(optionsAsString);
                 }
+		else if(msg.hasOwnProperty("risk_update"))
+		{
+			var values = msg.risk_update.values;
+			if(values.hasOwnProperty("error_msg"))
+			{
+				$('#report_output').val(values.error_msg);
+				return;
+			}
+
+			var report_output = '';
+			$.each(values, function(key, value){
+				report_output += key + ': ' + value + '\n';
+			});
+			$('#report_output').val(report_output);
+		}
 		else if(msg.hasOwnProperty("error_msg"))
 		{
 			$('#report_output').val(msg.error_msg);
@@ -236,7 +586,13 @@ $(document).ready(function(){
 		var risk_report = $('#risk_report_select').find(":selected").val();
                 var risk_report_trading_book = $('#risk_report_trading_books_select').find(":selected").val();
 
-                risk_report_ws.send(risk_report + " " + risk_report_trading_book);
+		// the report reruns on the server whenever the book trades or its prices move
+		var requests = [];
+		if (risk_topic !== null)
+			requests.push('unsubscribe ' + risk_topic);
+		risk_topic = 'risk:' + risk_report_trading_book + ':' + risk_report;
+		requests.push('subscribe_risk ' + risk_report + " " + risk_report_trading_book);
+                sendRequests(risk_report_ws, requests);
         });
 
 	$("#msg_input").keyup(function(e) {
@@ -0,0 +1,171 @@
+#ifndef BASKET_HPP
+#define BASKET_HPP
+
+#include "trade_journal.hpp"
+#include "json_writer.hpp"
+#include "date_util.hpp"
+#include "configuration.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+struct BasketError
+{
+	size_t line; // 1 based, 0 for the message as a whole
+	string error;
+};
+
+// Many trades in one booking message, booked all or none of them.
+//   text:   "basket <trade>;<trade>;..." with every trade "book1 book2 ticker quantity date"
+//   binary: "BSK1", u32 request id (0 for none), u32 n, then the columns u32 book1[n], u32 book2[n],
+//           i32 day[n] (days since 1970-01-01), i64 quantity[n], then n tickers as a u8 length and the
+//           characters. Little-endian, no padding.
+// Every line is checked before anything is booked, the ack lists what is wrong with which line.
+class Basket
+{
+private:
+	static uint64_t get(const string &frame, size_t offset, int n_bytes)
+	{
+		uint64_t v = 0;
+		for(int i = 0; i < n_bytes; ++i)
+			v |= (uint64_t)(unsigned char)frame[offset + i] << (8 * i);
+
+		return v;
+	}
+
+	bool too_many(size_t n)
+	{
+		size_t max_trades = Configuration::get_instance()->basket_max_trades;
+		if(n == 0 || n > max_trades)
+		{
+			errors.push_back(BasketError{0, "a basket has 1 to " + to_string(max_trades) + " trades"});
+			return true;
+		}
+
+		return false;
+	}
+
+public:
+	vector<Trade> trades;
+	vector<BasketError> errors; // nothing is booked unless this is empty
+	uint32_t request_id; // of a binary basket
+
+	Basket():request_id(0){}
+
+	static bool is_text(const string &payload)
+	{
+		return payload.compare(0, 7, "basket ") == 0;
+	}
+
+	static bool is_binary(const string &payload)
+	{
+		return payload.compare(0, 4, "BSK1") == 0;
+	}
+
+	bool parse(const string &payload)
+	{
+		return is_binary(payload) ? parse_binary(payload) : parse_text(payload.substr(7));
+	}
+
+	// "<trade>;<trade>;...", a ';' at the end is fine
+	bool parse_text(const string &lines)
+	{
+		size_t n = 0;
+		for(size_t pos = 0; pos < lines.size(); ++pos)
+			n += lines[pos] == ';';
+		if(too_many(lines.empty() || lines.back() == ';' ? n : n + 1))
+			return false;
+
+		trades.reserve(n + 1);
+		size_t start = 0;
+		while(start < lines.size())
+		{
+			size_t end = lines.find(';', start);
+			if(end == string::npos)
+				end = lines.size();
+
+			Trade trade;
+			string error = trade.error(lines.substr(start, end - start));
+			if(!error.empty())
+				errors.push_back(BasketError{trades.size() + 1, error});
+			trades.push_back(trade);
+			start = end + 1;
+		}
+
+		return errors.empty();
+	}
+
+	bool parse_binary(const string &frame)
+	{
+		if(frame.size() < 12)
+		{
+			errors.push_back(BasketError{0, "truncated basket"});
+			return false;
+		}
+
+		request_id = get(frame, 4, 4);
+		size_t n = get(frame, 8, 4);
+		if(too_many(n))
+			return false;
+
+		size_t books1 = 12, books2 = books1 + 4 * n, days = books2 + 4 * n, quantities = days + 4 * n, tickers = quantities + 8 * n;
+		if(frame.size() < tickers + n)
+		{
+			errors.push_back(BasketError{0, "truncated basket"});
+			return false;
+		}
+
+		trades.resize(n);
+		size_t offset = tickers;
+		for(size_t i = 0; i < n; ++i)
+		{
+			Trade &trade = trades[i];
+			trade.book1_id = to_string(get(frame, books1 + 4 * i, 4));
+			trade.book2_id = to_string(get(frame, books2 + 4 * i, 4));
+			trade.date = format_day((int32_t)get(frame, days + 4 * i, 4));
+			trade.quantity = (int64_t)get(frame, quantities + 8 * i, 8);
+
+			size_t length = offset < frame.size() ? (unsigned char)frame[offset] : 0;
+			if(offset + 1 + length > frame.size())
+			{
+				errors.push_back(BasketError{0, "truncated basket"});
+				return false;
+			}
+			trade.ticker = frame.substr(offset + 1, length);
+			offset += 1 + length;
+
+			string error = trade.check();
+			if(!error.empty())
+				errors.push_back(BasketError{i + 1, error});
+		}
+
+		return errors.empty();
+	}
+
+	// {"basket":{"trades":n,"booked":true|false,"errors":[{"line":..,"error":..}]}}, lines not listed are fine
+	static string ack_as_json(size_t n_trades, bool booked, const vector<BasketError> &errors)
+	{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("basket").begin_object();
+		writer.key("trades").value((long long)n_trades);
+		writer.key("booked").value(booked);
+		writer.key("errors").begin_array();
+		for(auto it = errors.begin(); it != errors.end(); ++it)
+		{
+			writer.begin_object();
+			writer.key("line").value((long long)it->line);
+			writer.key("error").value(it->error);
+			writer.end_object();
+		}
+		writer.end_array();
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
+};
+
+#endif
@@ -3,37 +3,248 @@
 
 #include "end_point.hpp"
 #include "mysql.hpp"
+#include "subscription_hub.hpp"
+#include "init_snapshot.hpp"
+#include "deal_index.hpp"
+#include "trade_journal.hpp"
+#include "basket.hpp"
+#include "position_keeper.hpp"
+#include "pre_trade_gate.hpp"
+#include "json_writer.hpp"
 #include <string>
 #include <sstream>
+#include <memory>
+#include <set>
+#include <map>
+#include <cstdlib>
 
 using namespace std;
 
 class BookingEndPoint: public EndPoint
 {
+private:
+	// refresh the deal row the trade landed in for subscribers of the trading book, and what depends on it
+	static void publish_trade(string book1_id, string book2_id, string ticker)
+	{
+		SubscriptionHub *hub = SubscriptionHub::get_instance();
+		hub->invalidate("deals:" + book1_id, vector<string>(1, book2_id + " " + ticker));
+
+		vector<string> tickers(1, ticker);
+		hub->invalidate("positions:" + book1_id, tickers);
+		hub->invalidate_prefix("risk:" + book1_id + ":", tickers);
+		InitSnapshot::get_instance()->invalidate(); // it carries a deal table
+	}
+
+	// trades are in Deal: positions move with every one, subscribers hear once per deal row they touched
+	static void trades_applied(const vector<Trade> &trades)
+	{
+		PositionKeeper *keeper = PositionKeeper::get_instance();
+		map<string, vector<DealChange>> deal_changes; // by trading book
+		set<string> published;
+		for(auto it = trades.begin(); it != trades.end(); ++it)
+		{
+			keeper->apply(it->book1_id, it->book2_id, it->ticker, it->quantity);
+			DealChange change = {it->book2_id, it->ticker, it->quantity, it->date};
+			deal_changes[it->book1_id].push_back(change);
+		}
+
+		for(auto it = deal_changes.begin(); it != deal_changes.end(); ++it)
+			DealIndex::get_instance()->apply(it->first, it->second);
+
+		for(auto it = trades.begin(); it != trades.end(); ++it)
+			if(published.insert(it->book1_id + " " + it->book2_id + " " + it->ticker).second)
+				publish_trade(it->book1_id, it->book2_id, it->ticker);
+	}
+
+	static string limit_error_as_json(const string &error)
+	{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("error_msg").value(error);
+		writer.end_object();
+
+		return writer.str();
+	}
+
+	// every trade of the basket against the pre-trade limits, one after the other as if booked in that order.
+	// false and none of them counted if any is over a limit.
+	static bool reserve(Basket &basket)
+	{
+		PreTradeGate *gate = PreTradeGate::get_instance();
+		vector<bool> reserved(basket.trades.size(), false);
+		for(size_t i = 0; i < basket.trades.size(); ++i)
+		{
+			string error = gate->reserve(basket.trades[i]);
+			if(error.empty())
+				reserved[i] = true;
+			else
+				basket.errors.push_back(BasketError{i + 1, error});
+		}
+
+		if(basket.errors.empty())
+			return true;
+
+		for(size_t i = 0; i < basket.trades.size(); ++i)
+			if(reserved[i])
+				gate->release(basket.trades[i]);
+		return false;
+	}
+
+	static void release(const vector<Trade> &trades)
+	{
+		PreTradeGate *gate = PreTradeGate::get_instance();
+		for(auto it = trades.begin(); it != trades.end(); ++it)
+			gate->release(*it);
+	}
+
+	// all trades of the basket or none, one ack for the whole of it. A binary basket carries its request id
+	// in the frame, the ack is text with that id as usual.
+	void book_basket(server *s, websocketpp::connection_hdl hdl, const Request &request)
+	{
+		shared_ptr<Basket> basket(new Basket());
+		basket->parse(request.payload);
+
+		Request ack = request;
+		ack.opcode = websocketpp::frame::opcode::text;
+		if(basket->request_id)
+		{
+			ack.id = basket->request_id;
+			ack.has_id = true;
+		}
+
+		if(!basket->errors.empty() || !reserve(*basket))
+		{
+			reply(hdl, ack, Basket::ack_as_json(basket->trades.size(), false, basket->errors), ack.opcode);
+			return;
+		}
+
+		size_t n_trades = basket->trades.size();
+		TradeJournal *journal = TradeJournal::get_instance();
+		if(journal->running())
+		{
+			journal->append(basket->trades, [this, hdl, ack, n_trades, basket](bool durable){
+				vector<BasketError> errors;
+				if(!durable)
+				{
+					release(basket->trades);
+					errors.push_back(BasketError{0, "the trade journal can not be written"});
+				}
+				reply(hdl, ack, Basket::ack_as_json(n_trades, durable, errors), ack.opcode);
+			});
+			return;
+		}
+
+		reply_async(s, hdl, ack, ack.opcode, BATCH, [basket, n_trades]{
+			MysqlManager *mysql_manager = MysqlManager::get_instance();
+			bool booked = mysql_manager->executeBatchUpdateAtomically("insert into Deal(Book1_ID, Book2_ID, Ticker, Quantity, Date) values", basket->trades,
+					"on duplicate key update Quantity=Quantity+values(Quantity)") >= 0;
+			vector<BasketError> errors;
+			if(booked)
+				trades_applied(basket->trades);
+			else
+			{
+				release(basket->trades);
+				errors.push_back(BasketError{0, "the db refused the basket"});
+			}
+
+			return Basket::ack_as_json(n_trades, booked, errors);
+		});
+	}
+
 public:
-	BookingEndPoint(int port):EndPoint(port){}
+	BookingEndPoint(int port, int n_threads = 0):EndPoint(port, n_threads)
+	{
+		TradeJournal::get_instance()->set_on_applied(trades_applied);
+		TradeJournal::get_instance()->set_on_replayed([](const vector<Trade> &trades){
+			for(auto it = trades.begin(); it != trades.end(); ++it)
+				PreTradeGate::get_instance()->reserve_unchecked(*it);
+		});
+		TradeJournal::get_instance()->set_on_skipped(release);
+	}
+
+	void on_open(server*, websocketpp::connection_hdl){}
 
-	void on_open(server *s, websocketpp::connection_hdl hdl){}
+	// a booking is "book1 book2 ticker quantity date", no msg_type to go by
+	string operation_of(const Request &request)
+	{
+		return Basket::is_text(request.payload) || Basket::is_binary(request.payload) ? "basket" : "booking";
+	}
 
-        void on_message(server *s, websocketpp::connection_hdl hdl, server::message_ptr msg)
+	// a booking is acknowledged ("1") as soon as it is in the trade journal, Deal follows a moment later.
+	// Without a journal it is inserted right here and the reply is the rows affected. Either way a trade over
+	// a pre-trade limit is not booked, the reply is {"error_msg":...} then. Baskets see basket.hpp.
+        void on_message(server *s, websocketpp::connection_hdl hdl, const Request &request)
         {
-		stringstream ss(msg->get_payload());
-	        string book1_id, book2_id, ticker, quantity, date;
-        	ss >> book1_id >> book2_id >> ticker >> quantity >> date;
-	        vector<vector<string>> insert_vals;
-
-        	vector<string> insert_val;
-	        insert_val.push_back(book1_id);
-        	insert_val.push_back(book2_id);
-	        insert_val.push_back(ticker);
-        	insert_val.push_back(quantity);
-	        insert_val.push_back(date);
-
-        	insert_vals.push_back(insert_val);
-
-	        MysqlManager *mysql_manager = MysqlManager::get_instance();
-        	int row_affected = mysql_manager->executeUpdate("insert into Deal(Book1_ID, Book2_ID, Ticker, Quantity, Date) values(?, ?, ?, ?, ?) ON DUPLICATE KEY UPDATE Quantity=Quantity+"+quantity, insert_vals);
-	        s->send(hdl, to_string(row_affected), msg->get_opcode());
+		if(Basket::is_text(request.payload) || Basket::is_binary(request.payload))
+		{
+			book_basket(s, hdl, request);
+			return;
+		}
+
+		TradeJournal *journal = TradeJournal::get_instance();
+		if(journal->running())
+		{
+			Trade trade;
+			if(!trade.parse(request.payload))
+			{
+				reply(hdl, request, "0", request.opcode);
+				return;
+			}
+
+			string limit = PreTradeGate::get_instance()->reserve(trade);
+			if(!limit.empty())
+			{
+				reply(hdl, request, limit_error_as_json(limit), request.opcode);
+				return;
+			}
+
+			journal->append(vector<Trade>(1, trade), [this, hdl, request, trade](bool durable){
+				if(!durable)
+					PreTradeGate::get_instance()->release(trade);
+				reply(hdl, request, durable ? "1" : "0", request.opcode);
+			});
+			return;
+		}
+
+		string payload = request.payload;
+		reply_async(s, hdl, request, request.opcode, INTERACTIVE, [payload]{
+			stringstream ss(payload);
+			string book1_id, book2_id, ticker, quantity, date;
+			ss >> book1_id >> book2_id >> ticker >> quantity >> date;
+
+			// only a trade that makes sense has a position to check, the db judges the rest as before
+			Trade trade;
+			bool reserved = trade.parse(payload);
+			if(reserved)
+			{
+				string limit = PreTradeGate::get_instance()->reserve(trade);
+				if(!limit.empty())
+					return limit_error_as_json(limit);
+			}
+
+			vector<vector<string>> insert_vals;
+
+			vector<string> insert_val;
+			insert_val.push_back(book1_id);
+			insert_val.push_back(book2_id);
+			insert_val.push_back(ticker);
+			insert_val.push_back(quantity);
+			insert_val.push_back(date);
+
+			insert_vals.push_back(insert_val);
+
+			MysqlManager *mysql_manager = MysqlManager::get_instance();
+			int row_affected = mysql_manager->executeUpdate("insert into Deal(Book1_ID, Book2_ID, Ticker, Quantity, Date) values(?, ?, ?, ?, ?) ON DUPLICATE KEY UPDATE Quantity=Quantity+"+quantity, insert_vals);
+			if(row_affected > 0)
+			{
+				PositionKeeper::get_instance()->apply(book1_id, book2_id, ticker, atof(quantity.c_str()));
+				publish_trade(book1_id, book2_id, ticker);
+			}
+			else if(reserved)
+				PreTradeGate::get_instance()->release(trade);
+
+			return to_string(row_affected);
+		});
         }
 
 };
@@ -0,0 +1,205 @@
+#ifndef CHART_CACHE_HPP
+#define CHART_CACHE_HPP
+
+#include "configuration.hpp"
+#include "metrics.hpp"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <functional>
+
+using namespace std;
+
+// Serialized chart replies by key (format:resolution:ticker), least recently used first out once they
+// take more than chart_cache_bytes. An entry remembers the version of the data it was built from and is
+// checked against it again when older than chart_revalidate_seconds, which costs a probe instead of the
+// whole history. Concurrent misses of one key build it once, the others are handed its result when it is
+// done rather than waiting for it on a worker.
+class ChartCache
+{
+private:
+	struct Entry
+	{
+		shared_ptr<const string> payload;
+		string version;
+		chrono::steady_clock::time_point checked;
+		list<string>::iterator recency;
+	};
+
+	// a build in progress, its waiters get what it made or null if it failed
+	struct Flight
+	{
+		vector<function<void(shared_ptr<const string>)>> waiters;
+	};
+
+	static ChartCache *instance;
+
+	mutex mtx;
+	unordered_map<string, Entry> entries;
+	list<string> recency; // most recently used first
+	unordered_map<string, shared_ptr<Flight>> flights;
+	size_t bytes;
+
+	atomic<long long> *hits;
+	atomic<long long> *misses;
+	atomic<long long> *coalesced;
+	atomic<long long> *revalidated;
+	atomic<long long> *evictions;
+
+	ChartCache():bytes(0)
+	{
+		Metrics *metrics = Metrics::get_instance();
+		hits = metrics->counter("chart_cache_total", "result=\"hit\"");
+		misses = metrics->counter("chart_cache_total", "result=\"miss\"");
+		coalesced = metrics->counter("chart_cache_total", "result=\"coalesced\"");
+		revalidated = metrics->counter("chart_cache_total", "result=\"revalidated\"");
+		evictions = metrics->counter("chart_cache_evictions");
+	}
+
+	void erase(unordered_map<string, Entry>::iterator it)
+	{
+		bytes -= it->second.payload->size();
+		recency.erase(it->second.recency);
+		entries.erase(it);
+	}
+
+	// store payload under key and evict from the cold end until the cache fits its budget again
+	void insert(const string &key, shared_ptr<const string> payload, const string &version)
+	{
+		size_t budget = Configuration::get_instance()->chart_cache_bytes;
+		auto old = entries.find(key);
+		if(old != entries.end())
+			erase(old);
+
+		if(payload->size() > budget)
+			return;
+
+		recency.push_front(key);
+		Entry &entry = entries[key];
+		entry.payload = payload;
+		entry.version = version;
+		entry.checked = chrono::steady_clock::now();
+		entry.recency = recency.begin();
+		bytes += payload->size();
+
+		while(bytes > budget)
+		{
+			erase(entries.find(recency.back()));
+			evictions->fetch_add(1, memory_order_relaxed);
+		}
+	}
+
+	void touch(Entry &entry)
+	{
+		recency.splice(recency.begin(), recency, entry.recency);
+	}
+
+public:
+	static ChartCache* get_instance()
+	{
+		if(!instance)
+			instance = new ChartCache();
+
+		return instance;
+	}
+
+	// hands done the payload of key, built with build when missing or when version_of no longer matches it.
+	// version_of should be cheap (a count, a max date, a checksum), build the expensive query and serialization.
+	// done runs before get returns, except for a miss of a key already being built: it runs on the thread
+	// of that build once it is done. It gets null if the build failed.
+	void get(const string &key, function<string()> version_of, function<string()> build, function<void(shared_ptr<const string>)> done)
+	{
+		chrono::seconds max_age(Configuration::get_instance()->chart_revalidate_seconds);
+		string checked_version;
+		bool have_version = false;
+		shared_ptr<const string> cached;
+		{
+			unique_lock<mutex> lock(mtx);
+			auto it = entries.find(key);
+			if(it != entries.end() && chrono::steady_clock::now() - it->second.checked < max_age)
+			{
+				touch(it->second);
+				hits->fetch_add(1, memory_order_relaxed);
+				cached = it->second.payload;
+			}
+			else
+			{
+				if(it != entries.end())
+				{
+					lock.unlock();
+					checked_version = version_of();
+					have_version = true;
+					lock.lock();
+
+					it = entries.find(key);
+					if(it != entries.end() && it->second.version == checked_version)
+					{
+						it->second.checked = chrono::steady_clock::now();
+						touch(it->second);
+						revalidated->fetch_add(1, memory_order_relaxed);
+						cached = it->second.payload;
+					}
+				}
+
+				if(!cached)
+				{
+					auto flight = flights.find(key);
+					if(flight != flights.end())
+					{
+						flight->second->waiters.push_back(done);
+						coalesced->fetch_add(1, memory_order_relaxed);
+						return;
+					}
+
+					shared_ptr<Flight> building(new Flight());
+					building->waiters.push_back(done);
+					flights[key] = building;
+				}
+			}
+		}
+
+		if(cached)
+		{
+			done(cached);
+			return;
+		}
+
+		misses->fetch_add(1, memory_order_relaxed);
+		shared_ptr<const string> payload;
+		try{
+			if(!have_version)
+				checked_version = version_of();
+			payload.reset(new string(build()));
+		}catch(const std::exception &exc){
+			cout << "failed to build " << key << " because:" << exc.what() << endl;
+		}
+
+		shared_ptr<Flight> flight;
+		{
+			lock_guard<mutex> lock(mtx);
+			if(payload)
+				insert(key, payload, checked_version);
+			flight = flights[key];
+			flights.erase(key);
+		}
+
+		// one waiter failing to answer does not keep the result from the others
+		for(auto it = flight->waiters.begin(); it != flight->waiters.end(); ++it)
+		{
+			try{
+				(*it)(payload);
+			}catch(const std::exception &exc){
+				cout << "failed to hand " << key << " to a waiter because:" << exc.what() << endl;
+			}
+		}
+	}
+};
+
+ChartCache *ChartCache::instance = NULL;
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#include "configuration.hpp"
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <zlib.h>
+
+using namespace std;
+
+namespace deflate_error = websocketpp::extensions::permessage_deflate::error;
+
+// what the last compress() on this thread did. websocketpp compresses inside connection::send on the
+// calling thread, so the sender reads it right after sending to account it to its end point.
+struct DeflateRecord
+{
+	size_t bytes_in;
+	size_t bytes_out;
+	long long cpu_ns;
+};
+
+static thread_local DeflateRecord last_deflate;
+
+inline long long thread_cpu_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// compression counters of one end point
+struct CompressionStats
+{
+	atomic<long long> messages; // sent as data frames
+	atomic<long long> compressed; // of those, compressed
+	atomic<long long> bytes_in; // before compression, compressed messages only
+	atomic<long long> bytes_out;
+	atomic<long long> cpu_ns;
+
+	CompressionStats():messages(0), compressed(0), bytes_in(0), bytes_out(0), cpu_ns(0){}
+};
+
+// websocketpp's permessage-deflate with the level, memory level, window and context takeover taken from
+// Configuration. The stock extension hardcodes its zlib settings, so outgoing data goes through a
+// deflate stream of our own and the base keeps negotiation and inflating.
+template <typename config>
+class TunedDeflate: public websocketpp::extensions::permessage_deflate::enabled<config>
+{
+private:
+	typedef websocketpp::extensions::permessage_deflate::enabled<config> base;
+
+	z_stream deflate_state;
+	bool deflate_ready;
+	int flush;
+	int window_bits;
+	bool context_takeover;
+	bool refused; // negotiated something zlib can not do, frames go out uncompressed
+	unique_ptr<unsigned char[]> buffer;
+	static const size_t buffer_size = 16384;
+
+public:
+	TunedDeflate():deflate_ready(false), flush(Z_SYNC_FLUSH), refused(false)
+	{
+		Configuration *settings = Configuration::get_instance();
+		// raw deflate in zlib does not do 8 bit windows
+		window_bits = settings->deflate_window_bits < 9 ? 9 : (settings->deflate_window_bits > 15 ? 15 : settings->deflate_window_bits);
+		context_takeover = settings->deflate_context_takeover;
+
+		base::set_server_max_window_bits(window_bits, websocketpp::extensions::permessage_deflate::mode::largest);
+		if(!context_takeover)
+			base::enable_server_no_context_takeover();
+	}
+
+	// the client's offer can shrink the window or turn off context takeover, read back what was agreed
+	websocketpp::err_str_pair negotiate(websocketpp::http::attribute_list const &offer)
+	{
+		websocketpp::err_str_pair ret = base::negotiate(offer);
+		if(ret.first)
+			return ret;
+
+		const string &response = ret.second;
+		if(response.find("server_no_context_takeover") != string::npos)
+			context_takeover = false;
+
+		size_t pos = response.find("server_max_window_bits=");
+		if(pos != string::npos)
+		{
+			int bits = atoi(response.c_str() + pos + 23);
+			if(bits >= 9 && bits < window_bits)
+				window_bits = bits;
+			else if(bits == 8) // zlib can not go below 9
+			{
+				refused = true;
+				ret.first = deflate_error::make_error_code(deflate_error::invalid_max_window_bits);
+			}
+		}
+
+		return ret;
+	}
+
+	bool is_enabled() const
+	{
+		return base::is_enabled() && !refused;
+	}
+
+	websocketpp::lib::error_code init(bool is_server)
+	{
+		websocketpp::lib::error_code ec = base::init(is_server);
+		if(ec)
+			return ec;
+
+		Configuration *settings = Configuration::get_instance();
+		deflate_state.zalloc = Z_NULL;
+		deflate_state.zfree = Z_NULL;
+		deflate_state.opaque = Z_NULL;
+		if(deflateInit2(&deflate_state, settings->deflate_level, Z_DEFLATED, -window_bits, settings->deflate_mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+			return deflate_error::make_error_code(deflate_error::zlib_error);
+
+		deflate_ready = true;
+		flush = context_takeover ? Z_SYNC_FLUSH : Z_FULL_FLUSH;
+		buffer.reset(new unsigned char[buffer_size]);
+		return ec;
+	}
+
+	websocketpp::lib::error_code compress(string const &in, string &out)
+	{
+		if(!deflate_ready)
+			return deflate_error::make_error_code(deflate_error::uninitialized);
+
+		if(in.empty())
+		{
+			uint8_t empty[6] = {0x02, 0x00, 0x00, 0x00, 0xff, 0xff};
+			out.append((char*)empty, 6);
+			return websocketpp::lib::error_code();
+		}
+
+		long long start = thread_cpu_ns();
+		size_t out_start = out.size();
+
+		deflate_state.avail_in = in.size();
+		deflate_state.next_in = (unsigned char*)in.data();
+		do
+		{
+			deflate_state.avail_out = buffer_size;
+			deflate_state.next_out = buffer.get();
+			deflate(&deflate_state, flush);
+			out.append((char*)buffer.get(), buffer_size - deflate_state.avail_out);
+		} while(deflate_state.avail_out == 0);
+
+		last_deflate.bytes_in = in.size();
+		last_deflate.bytes_out = out.size() - out_start - 4; // the trailer is stripped before sending
+		last_deflate.cpu_ns = thread_cpu_ns() - start;
+
+		return websocketpp::lib::error_code();
+	}
+
+	~TunedDeflate()
+	{
+		if(deflate_ready)
+			deflateEnd(&deflate_state);
+	}
+};
+
+// asio server config with permessage-deflate, offered to every client that asks for it
+struct deflate_config: public websocketpp::config::asio
+{
+	typedef deflate_config type;
+	typedef websocketpp::config::asio base;
+
+	struct permessage_deflate_config: public base::permessage_deflate_config {};
+
+	typedef TunedDeflate<permessage_deflate_config> permessage_deflate_type;
+};
+
+#endif
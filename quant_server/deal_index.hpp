@@ -0,0 +1,259 @@
+#ifndef DEAL_INDEX_HPP
+#define DEAL_INDEX_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "date_util.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+// the deals of one trading book column by column, with the row order for every sort key worked out once
+struct BookDeals
+{
+	vector<string> ticker;
+	vector<int> customer_book;
+	vector<long long> quantity;
+	vector<int> day;
+	vector<uint32_t> by_ticker; // ties by customer book
+	vector<uint32_t> by_quantity; // ties by ticker
+	vector<uint32_t> by_day; // ties by ticker
+	chrono::steady_clock::time_point loaded;
+
+	size_t size() const { return ticker.size(); }
+};
+
+// what a trade did to a row of its trading book: Deal adds quantity to the row of (customer book, ticker),
+// or inserts it with date when there is none
+struct DealChange
+{
+	string book2_id;
+	string ticker;
+	long long quantity;
+	string date;
+};
+
+// which page of a book's deals to list: sort is ticker, quantity or date, "-" in front for descending
+struct DealQuery
+{
+	string book_id;
+	size_t page;
+	size_t page_size;
+	string sort;
+	bool descending;
+	string ticker; // only this ticker, "" for all
+
+	DealQuery():page(0), page_size(50), sort("ticker"), descending(false){}
+
+	// from "<book id> [page] [page size] [sort] [ticker]", false if any of it is off
+	bool parse(const vector<string> &args)
+	{
+		if(args.empty())
+			return false;
+
+		book_id = args[0];
+		if(args.size() > 1)
+			page = strtoul(args[1].c_str(), NULL, 10);
+		if(args.size() > 2)
+			page_size = strtoul(args[2].c_str(), NULL, 10);
+		if(args.size() > 3)
+		{
+			descending = args[3][0] == '-';
+			sort = descending ? args[3].substr(1) : args[3];
+		}
+		if(args.size() > 4)
+			ticker = args[4];
+
+		page_size = min(page_size, (size_t)Configuration::get_instance()->deal_page_size_max);
+		return page_size > 0 && (sort == "ticker" || sort == "quantity" || sort == "date");
+	}
+};
+
+// Deals per trading book held in memory for paged listings. A page is a slice of a presorted permutation,
+// or with a ticker filter and sort by ticker a binary searched range of it, so even books with tens of
+// thousands of deals answer without touching the db. Trades are applied to a resident book row by row,
+// moving only the rows they touch in the permutations; books are reloaded once older than
+// init_refresh_seconds in case the table changed behind our back.
+class DealIndex
+{
+private:
+	static DealIndex *instance;
+
+	mutex mtx;
+	map<string, shared_ptr<const BookDeals>> books;
+	map<string, long long> changes; // trades applied per book, a load that saw another number may have missed one
+
+	static bool ticker_order(const BookDeals &d, uint32_t a, uint32_t b)
+	{
+		return d.ticker[a] != d.ticker[b] ? d.ticker[a] < d.ticker[b] : d.customer_book[a] < d.customer_book[b];
+	}
+
+	static bool quantity_order(const BookDeals &d, uint32_t a, uint32_t b)
+	{
+		return d.quantity[a] != d.quantity[b] ? d.quantity[a] < d.quantity[b] : d.ticker[a] < d.ticker[b];
+	}
+
+	static bool day_order(const BookDeals &d, uint32_t a, uint32_t b)
+	{
+		return d.day[a] != d.day[b] ? d.day[a] < d.day[b] : d.ticker[a] < d.ticker[b];
+	}
+
+	// put row into order where less says it goes
+	static void place(const BookDeals &d, vector<uint32_t> &order, uint32_t row, bool (*less)(const BookDeals&, uint32_t, uint32_t))
+	{
+		order.insert(upper_bound(order.begin(), order.end(), row, [&d, less](uint32_t a, uint32_t b){ return less(d, a, b); }), row);
+	}
+
+	// deals with change applied, the rows it does not touch keep their places
+	static void apply(BookDeals &d, const DealChange &change)
+	{
+		int customer_book = atoi(change.book2_id.c_str());
+		auto found = lower_bound(d.by_ticker.begin(), d.by_ticker.end(), make_pair(&change.ticker, customer_book),
+			[&d](uint32_t row, const pair<const string*, int> &key){
+				return d.ticker[row] != *key.first ? d.ticker[row] < *key.first : d.customer_book[row] < key.second;
+			});
+
+		if(found != d.by_ticker.end() && d.ticker[*found] == change.ticker && d.customer_book[*found] == customer_book)
+		{
+			uint32_t row = *found;
+			d.by_quantity.erase(find(d.by_quantity.begin(), d.by_quantity.end(), row));
+			d.quantity[row] += change.quantity;
+			place(d, d.by_quantity, row, quantity_order);
+			return;
+		}
+
+		uint32_t row = d.size();
+		d.ticker.push_back(change.ticker);
+		d.customer_book.push_back(customer_book);
+		d.quantity.push_back(change.quantity);
+		d.day.push_back(parse_day(change.date));
+		place(d, d.by_ticker, row, ticker_order);
+		place(d, d.by_quantity, row, quantity_order);
+		place(d, d.by_day, row, day_order);
+	}
+
+	static shared_ptr<const BookDeals> load(const string &book_id)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Book2_ID, Ticker, Quantity, Date from Deal where Book1_ID = ?", {book_id}));
+
+		shared_ptr<BookDeals> deals(new BookDeals());
+		while(res->next())
+		{
+			deals->ticker.push_back(res->getString("Ticker"));
+			deals->customer_book.push_back(res->getInt("Book2_ID"));
+			deals->quantity.push_back(res->getInt64("Quantity"));
+			deals->day.push_back(parse_day(res->getString("Date")));
+		}
+
+		const BookDeals &d = *deals;
+		vector<uint32_t> rows(d.size());
+		for(uint32_t i = 0; i < rows.size(); ++i)
+			rows[i] = i;
+
+		deals->by_ticker = rows;
+		sort(deals->by_ticker.begin(), deals->by_ticker.end(), [&d](uint32_t a, uint32_t b){ return ticker_order(d, a, b); });
+		deals->by_quantity = rows;
+		sort(deals->by_quantity.begin(), deals->by_quantity.end(), [&d](uint32_t a, uint32_t b){ return quantity_order(d, a, b); });
+		deals->by_day = rows;
+		sort(deals->by_day.begin(), deals->by_day.end(), [&d](uint32_t a, uint32_t b){ return day_order(d, a, b); });
+
+		deals->loaded = chrono::steady_clock::now();
+		return deals;
+	}
+
+	DealIndex(){}
+
+public:
+	static DealIndex* get_instance()
+	{
+		if(!instance)
+			instance = new DealIndex();
+
+		return instance;
+	}
+
+	shared_ptr<const BookDeals> get(const string &book_id)
+	{
+		chrono::seconds max_age(max(1, Configuration::get_instance()->init_refresh_seconds));
+		long long seen;
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = books.find(book_id);
+			if(it != books.end() && chrono::steady_clock::now() - it->second->loaded < max_age)
+				return it->second;
+			seen = changes[book_id];
+		}
+
+		shared_ptr<const BookDeals> deals = load(book_id);
+		lock_guard<mutex> lock(mtx);
+		if(seen == changes[book_id])
+			books[book_id] = deals;
+		else if(books.count(book_id))
+			return books[book_id]; // it has the trades the load may have missed
+
+		return deals;
+	}
+
+	// trades of book_id are in Deal. A resident book gets them applied to a copy, listings already running
+	// keep the one they have.
+	void apply(const string &book_id, const vector<DealChange> &book_changes)
+	{
+		lock_guard<mutex> lock(mtx);
+		++changes[book_id];
+
+		auto it = books.find(book_id);
+		if(it == books.end())
+			return;
+
+		shared_ptr<BookDeals> deals(new BookDeals(*it->second));
+		for(auto change = book_changes.begin(); change != book_changes.end(); ++change)
+			apply(*deals, *change);
+		it->second = deals;
+	}
+
+	// rows of the page query asks for, in order, and how many rows there are over all pages
+	static vector<uint32_t> page(const BookDeals &deals, const DealQuery &query, size_t &total)
+	{
+		const vector<uint32_t> &order = query.sort == "quantity" ? deals.by_quantity : (query.sort == "date" ? deals.by_day : deals.by_ticker);
+		vector<uint32_t>::const_iterator first = order.begin(), last = order.end();
+		vector<uint32_t> filtered;
+
+		if(!query.ticker.empty() && query.sort == "ticker")
+		{
+			const string &ticker = query.ticker;
+			first = lower_bound(order.begin(), order.end(), ticker, [&deals](uint32_t row, const string &t){ return deals.ticker[row] < t; });
+			last = upper_bound(first, order.end(), ticker, [&deals](const string &t, uint32_t row){ return t < deals.ticker[row]; });
+		}
+		else if(!query.ticker.empty())
+		{
+			for(auto it = order.begin(); it != order.end(); ++it)
+				if(deals.ticker[*it] == query.ticker)
+					filtered.push_back(*it);
+			first = filtered.begin();
+			last = filtered.end();
+		}
+
+		total = last - first;
+		vector<uint32_t> rows;
+		if(query.page > total / query.page_size)
+			return rows;
+
+		size_t begin = query.page * query.page_size;
+		for(size_t i = begin; i < total && i < begin + query.page_size; ++i)
+			rows.push_back(query.descending ? *(last - 1 - i) : *(first + i));
+
+		return rows;
+	}
+};
+
+DealIndex *DealIndex::instance = NULL;
+
+#endif
@@ -3,9 +3,26 @@
 
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
+#include "compression.hpp"
+#include "task_scheduler.hpp"
+#include "subscription_hub.hpp"
+#include "json_writer.hpp"
+#include "metrics.hpp"
 #include <thread>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <string>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cctype>
 
-typedef websocketpp::server<websocketpp::config::asio> server;
+typedef websocketpp::server<deflate_config> server;
 
 using websocketpp::lib::placeholders::_1;
 using websocketpp::lib::placeholders::_2;
@@ -13,29 +30,703 @@ using websocketpp::lib::bind;
 
 using namespace std;
 
+// what an end point remembers about one open connection
+struct ConnectionState
+{
+	bool binary; // negotiated "wire_format binary", json otherwise
+	set<string> stale_topics; // updates dropped over budget, a snapshot is owed once the client catches up
+	bool over_budget;
+	chrono::steady_clock::time_point over_budget_since;
+	bool closing; // disconnected for being slow, waiting for the close to go through
+	deque<pair<TaskPriority, function<void()>>> ordered; // async work of requests without an id, waiting for the one before
+	bool ordered_running;
+
+	ConnectionState():binary(false), over_budget(false), closing(false), ordered_running(false){}
+};
+
+// outbound flow control counters of one end point
+struct SendStats
+{
+	atomic<long long> pushes; // updates offered to subscribers
+	atomic<long long> dropped; // of those, not sent because the connection was over budget or behind on the topic
+	atomic<long long> resyncs; // snapshots sent to connections that caught up
+	atomic<long long> slow_disconnects; // over budget for slow_consumer_seconds
+	atomic<long long> overflow_disconnects; // a reply found 4 budgets queued
+
+	SendStats():pushes(0), dropped(0), resyncs(0), slow_disconnects(0), overflow_disconnects(0){}
+};
+
+// One request of a frame. A frame is either a single bare request ("msg_type msg_val", answered with a bare
+// reply as before) or one or more lines "#<id> msg_type msg_val". Those are handled independently, may
+// complete in any order, and text replies come back as "#<id> <reply>" (binary frames carry the id themselves).
+struct Request
+{
+	string payload; // msg_type msg_val
+	uint32_t id;
+	bool has_id;
+	websocketpp::frame::opcode::value opcode;
+	string operation; // what its latency is recorded under, "" for nothing
+	long long received_ns; // when its frame came in, Metrics::now_ns
+	size_t id_offset; // where a binary reply shared between requests gets the id written on its way out, npos if it has it already
+
+	Request():id(0), has_id(false), opcode(websocketpp::frame::opcode::text), received_ns(0), id_offset(string::npos){}
+
+	Request(const string &payload, websocketpp::frame::opcode::value opcode):payload(payload), id(0), has_id(false), opcode(opcode), received_ns(0), id_offset(string::npos){}
+};
+
+// Messages of one connection are read and handled on that connection's strand, while different connections
+// are handled in parallel by however many threads run the io_service. Work handed to the task scheduler
+// (reply_async, reply_deferred) for requests without an id runs one after the other per connection, so
+// those are answered in the order they came in; requests with an id run side by side, in any order.
+//
+// Each connection may have send_budget_bytes queued but not yet written. Pushed updates that would go over
+// it are dropped and the topic is marked stale: later updates of it are dropped too, since they would be
+// stale by the time they got through. Once the queue is down to half the budget the client gets one
+// snapshot per stale topic. A connection that stays over budget slow_consumer_seconds is closed, and so
+// is one whose queue passes 4 budgets, which only replies can do.
 class EndPoint
 {
 private:
+	static const long housekeeping_ms = 200;
+
 	int port;
+	int n_threads; // 0 runs on the io_service shared by all end points, otherwise on its own with that many threads
+	unique_ptr<websocketpp::lib::asio::io_service> own_io_service;
 	server _server;
+	mutex connections_mtx;
+	map<websocketpp::connection_hdl, ConnectionState, owner_less<websocketpp::connection_hdl>> connections; // open connections, closed on drain
+	CompressionStats compression_stats;
+	SendStats send_stats;
+	server::timer_ptr housekeeping_timer;
+	bool draining;
+
+	void handle_open(websocketpp::connection_hdl hdl)
+	{
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			connections[hdl] = ConnectionState();
+		}
+
+		on_open(&_server, hdl);
+	}
+
+	// latency of one stage of request: queue (receipt to handler start), handler, db, compute (handler time
+	// outside the db: serialization, or the model run of a report), send (including compression) and total
+	static void record(const Request &request, const char *stage, long long ns)
+	{
+		if(!request.operation.empty())
+			Metrics::get_instance()->histogram("request_latency_us", "op=\"" + request.operation + "\",stage=\"" + stage + "\"")->record(ns);
+	}
+
+	// requests every end point answers itself, the rest go to on_message
+	void dispatch(websocketpp::connection_hdl hdl, Request &request)
+	{
+		if(request.payload == "metrics")
+		{
+			reply(hdl, request, Metrics::get_instance()->exposition(), websocketpp::frame::opcode::text);
+			return;
+		}
+
+		if(request.payload == "compression_stats")
+		{
+			reply(hdl, request, compression_stats_as_json(), websocketpp::frame::opcode::text);
+			return;
+		}
+
+		if(request.payload == "send_stats")
+		{
+			reply(hdl, request, send_stats_as_json(), websocketpp::frame::opcode::text);
+			return;
+		}
+
+		if(request.payload.compare(0, 12, "unsubscribe ") == 0)
+		{
+			string topic = request.payload.substr(12);
+			SubscriptionHub::get_instance()->unsubscribe(topic, this, hdl);
+			acknowledge(hdl, request, "unsubscribed", topic);
+			return;
+		}
+
+		request.operation = operation_of(request);
+		Metrics::get_instance()->counter("requests_total", "op=\"" + request.operation + "\"")->fetch_add(1, memory_order_relaxed);
+
+		on_message(&_server, hdl, request);
+	}
+
+	void handle_message(websocketpp::connection_hdl hdl, server::message_ptr msg)
+	{
+		long long received_ns = Metrics::now_ns();
+		const string &payload = msg->get_payload();
+		if(payload.empty() || payload[0] != '#')
+		{
+			Request request(payload, msg->get_opcode());
+			request.received_ns = received_ns;
+			dispatch(hdl, request);
+			return;
+		}
+
+		size_t line_start = 0;
+		int line_index = 0;
+		while(line_start < payload.size())
+		{
+			size_t line_end = payload.find('\n', line_start);
+			if(line_end == string::npos)
+				line_end = payload.size();
+
+			// #<id> then a space then the request
+			size_t id_end = line_start + 1;
+			while(id_end < line_end && isdigit(payload[id_end]))
+				++id_end;
+
+			if(payload[line_start] == '#' && id_end > line_start + 1 && id_end - line_start <= 10 && id_end < line_end && payload[id_end] == ' ')
+			{
+				Request request(payload.substr(id_end + 1, line_end - id_end - 1), msg->get_opcode());
+				request.id = strtoul(payload.c_str() + line_start + 1, NULL, 10);
+				request.has_id = true;
+				request.received_ns = received_ns;
+				dispatch(hdl, request);
+			}
+			else if(line_end > line_start)
+			{
+				// answered under the id when it can be read, so a client waiting for it hears back,
+				// otherwise the error says which line of the frame it was
+				Request request;
+				request.has_id = payload[line_start] == '#' && id_end > line_start + 1 && id_end - line_start <= 10;
+				if(request.has_id)
+					request.id = strtoul(payload.c_str() + line_start + 1, NULL, 10);
+
+				JsonWriter &writer = JsonWriter::thread_writer();
+				writer.begin_object().key("error_msg").value("malformed request: " + payload.substr(line_start, line_end - line_start));
+				if(!request.has_id)
+					writer.key("line").value(line_index);
+				writer.end_object();
+				reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+			}
+
+			line_start = line_end + 1;
+			++line_index;
+		}
+	}
+
+	void handle_close(websocketpp::connection_hdl hdl)
+	{
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			connections.erase(hdl);
+		}
+
+		SubscriptionHub::get_instance()->unsubscribe_all(this, hdl);
+
+		on_close(&_server, hdl);
+	}
+
+	// plain http GET /metrics on the websocket port, for scrapers
+	void handle_http(websocketpp::connection_hdl hdl)
+	{
+		server::connection_ptr con = _server.get_con_from_hdl(hdl);
+		if(con->get_resource() != "/metrics")
+		{
+			con->set_status(websocketpp::http::status_code::not_found);
+			return;
+		}
+
+		con->set_status(websocketpp::http::status_code::ok);
+		con->append_header("Content-Type", "text/plain; version=0.0.4");
+		con->set_body(Metrics::get_instance()->exposition());
+	}
+
+	// catch up connections that drained their queue and close the ones that did not for too long
+	void housekeep(const websocketpp::lib::error_code &ec)
+	{
+		if(ec)
+			return; // cancelled by drain
+
+		Configuration *settings = Configuration::get_instance();
+		size_t budget = settings->send_budget_bytes;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+		vector<pair<websocketpp::connection_hdl, string>> resync;
+		vector<websocketpp::connection_hdl> slow;
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			for(auto it = connections.begin(); it != connections.end(); ++it)
+			{
+				ConnectionState &state = it->second;
+				if(state.closing || (!state.over_budget && state.stale_topics.empty()))
+					continue;
+
+				websocketpp::lib::error_code con_ec;
+				server::connection_ptr con = _server.get_con_from_hdl(it->first, con_ec);
+				if(con_ec)
+					continue;
+
+				if(con->get_buffered_amount() <= budget / 2)
+				{
+					for(auto topic = state.stale_topics.begin(); topic != state.stale_topics.end(); ++topic)
+						resync.push_back(make_pair(it->first, *topic));
+					state.stale_topics.clear();
+					state.over_budget = false;
+				}
+				else if(state.over_budget && now - state.over_budget_since > chrono::seconds(settings->slow_consumer_seconds))
+				{
+					state.closing = true;
+					slow.push_back(it->first);
+				}
+			}
+
+			if(!draining)
+				housekeeping_timer = _server.set_timer(housekeeping_ms, bind(&EndPoint::housekeep, this, ::_1));
+		}
+
+		for(auto it = resync.begin(); it != resync.end(); ++it)
+		{
+			websocketpp::connection_hdl hdl = it->first;
+			string topic = it->second;
+			// a snapshot costs what a refresh of the topic does, so it runs at the same priority
+			TaskScheduler::get_instance()->post(SubscriptionHub::get_instance()->priority_of(topic), [this, hdl, topic]{
+				string snapshot = SubscriptionHub::get_instance()->snapshot(topic);
+				if(snapshot.empty())
+					return;
+
+				send(hdl, snapshot, websocketpp::frame::opcode::text);
+				send_stats.resyncs++;
+			});
+		}
+
+		for(auto it = slow.begin(); it != slow.end(); ++it)
+		{
+			websocketpp::lib::error_code close_ec;
+			_server.close(*it, websocketpp::close::status::policy_violation, "slow consumer", close_ec);
+			send_stats.slow_disconnects++;
+		}
+	}
+
+	// the connection's request without an id that replied lets the next one waiting run
+	void next_ordered(websocketpp::connection_hdl hdl)
+	{
+		pair<TaskPriority, function<void()>> next;
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			auto it = connections.find(hdl);
+			if(it == connections.end())
+				return;
+
+			ConnectionState &state = it->second;
+			if(state.ordered.empty())
+			{
+				state.ordered_running = false;
+				return;
+			}
+			next = state.ordered.front();
+			state.ordered.pop_front();
+		}
+
+		TaskScheduler::get_instance()->post(next.first, next.second);
+	}
+
 public:
-	EndPoint(int port)
+	EndPoint(int port, int n_threads = 0):draining(false)
 	{
 		this->port = port;
+		this->n_threads = n_threads;
 	}
 
 	virtual void on_open(server *s, websocketpp::connection_hdl hdl) = 0;
-	virtual void on_message(server *s, websocketpp::connection_hdl hdl, server::message_ptr msg) = 0;
+	virtual void on_message(server *s, websocketpp::connection_hdl hdl, const Request &request) = 0;
+	virtual void on_close(server*, websocketpp::connection_hdl){}
+
+	// the msg_type of request, end points whose requests have none name them themselves.
+	// Anything but letters, digits and _ is "other", clients must not be able to make up series.
+	virtual string operation_of(const Request &request)
+	{
+		string operation = request.payload.substr(0, request.payload.find(' '));
+		if(operation.empty() || operation.size() > 64)
+			return "other";
+
+		for(auto it = operation.begin(); it != operation.end(); ++it)
+			if(!isalnum((unsigned char)*it) && *it != '_')
+				return "other";
+
+		return operation;
+	}
+
+	int get_port()
+	{
+		return port;
+	}
+
+	int get_threads()
+	{
+		return n_threads;
+	}
+
+	void set_binary(websocketpp::connection_hdl hdl, bool binary)
+	{
+		lock_guard<mutex> lock(connections_mtx);
+		auto it = connections.find(hdl);
+		if(it != connections.end())
+			it->second.binary = binary;
+	}
 
-	void run()
+	bool is_binary(websocketpp::connection_hdl hdl)
 	{
-		_server.init_asio();
-		_server.set_open_handler(bind(&EndPoint::on_open, this, &_server, ::_1));
-		_server.set_message_handler(bind(&EndPoint::on_message, this, &_server, ::_1, ::_2));
+		lock_guard<mutex> lock(connections_mtx);
+		auto it = connections.find(hdl);
+		return it != connections.end() && it->second.binary;
+	}
+
+	// the io_service the end point is served on: the shared one, or its own when it has dedicated threads
+	websocketpp::lib::asio::io_service* get_io_service(websocketpp::lib::asio::io_service *shared_io_service)
+	{
+		if(n_threads == 0)
+			return shared_io_service;
+
+		if(!own_io_service)
+			own_io_service.reset(new websocketpp::lib::asio::io_service());
+
+		return own_io_service.get();
+	}
+
+	// start accepting on io_service, see get_io_service
+	void listen(websocketpp::lib::asio::io_service *io_service)
+	{
+		_server.init_asio(io_service);
+		_server.set_reuse_addr(true);
+		_server.set_open_handler(bind(&EndPoint::handle_open, this, ::_1));
+		_server.set_close_handler(bind(&EndPoint::handle_close, this, ::_1));
+		_server.set_message_handler(bind(&EndPoint::handle_message, this, ::_1, ::_2));
+		_server.set_http_handler(bind(&EndPoint::handle_http, this, ::_1));
 		_server.listen(port);
 		_server.start_accept();
-		thread(&server::run, &_server).detach();
+
+		lock_guard<mutex> lock(connections_mtx);
+		housekeeping_timer = _server.set_timer(housekeeping_ms, bind(&EndPoint::housekeep, this, ::_1));
+	}
+
+	// run handler on the strand of the connection, ordered with its reads and anything already posted for it.
+	// Dropped if the connection is gone.
+	void post(websocketpp::connection_hdl hdl, function<void()> handler)
+	{
+		websocketpp::lib::error_code ec;
+		server::connection_ptr con = _server.get_con_from_hdl(hdl, ec);
+		if(!ec)
+			con->get_strand()->post(handler);
+	}
+
+	// send payload to hdl, compressed when the client negotiated permessage-deflate and it is at least
+	// deflate_min_bytes. Compression runs on the calling thread, so big replies belong on the task scheduler
+	// (see reply_async) rather than on the io threads. prefix goes in front of payload and id, if there is an
+	// id_offset, over the 4 bytes there, both in the message itself so payload is copied once.
+	void send(websocketpp::connection_hdl hdl, const string &payload, websocketpp::frame::opcode::value opcode, const string &prefix = "", size_t id_offset = string::npos, uint32_t id = 0)
+	{
+		websocketpp::lib::error_code ec;
+		server::connection_ptr con = _server.get_con_from_hdl(hdl, ec);
+		if(ec)
+			return; // the client may have left meanwhile
+
+		size_t size = prefix.size() + payload.size();
+		server::message_ptr msg = con->get_message(opcode, size);
+		msg->append_payload(prefix);
+		msg->append_payload(payload);
+		if(id_offset != string::npos && prefix.size() + id_offset + 4 <= size)
+		{
+			string &raw = msg->get_raw_payload();
+			for(int i = 0; i < 4; ++i)
+				raw[prefix.size() + id_offset + i] = (char)((id >> (8 * i)) & 0xff);
+		}
+		msg->set_compressed((int)size >= Configuration::get_instance()->deflate_min_bytes);
+
+		last_deflate.bytes_in = 0;
+		ec = con->send(msg);
+		if(ec)
+			return;
+
+		compression_stats.messages++;
+		if(last_deflate.bytes_in)
+		{
+			compression_stats.compressed++;
+			compression_stats.bytes_in += last_deflate.bytes_in;
+			compression_stats.bytes_out += last_deflate.bytes_out;
+			compression_stats.cpu_ns += last_deflate.cpu_ns;
+		}
+	}
+
+	string compression_stats_as_json()
+	{
+		long long bytes_in = compression_stats.bytes_in;
+		long long bytes_out = compression_stats.bytes_out;
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("compression").begin_object();
+		writer.key("port").value(port);
+		writer.key("messages").value((long long)compression_stats.messages);
+		writer.key("compressed").value((long long)compression_stats.compressed);
+		writer.key("bytes_in").value(bytes_in);
+		writer.key("bytes_out").value(bytes_out);
+		writer.key("ratio").value(bytes_out ? (double)bytes_in / bytes_out : 0.0);
+		writer.key("cpu_ms").value(compression_stats.cpu_ns / 1e6);
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
+
+	// the counters plus what is queued right now
+	string send_stats_as_json()
+	{
+		size_t total_buffered = 0, max_buffered = 0, stale_topics = 0;
+		int over_budget = 0;
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			for(auto it = connections.begin(); it != connections.end(); ++it)
+			{
+				websocketpp::lib::error_code ec;
+				server::connection_ptr con = _server.get_con_from_hdl(it->first, ec);
+				if(ec)
+					continue;
+
+				size_t buffered = con->get_buffered_amount();
+				total_buffered += buffered;
+				max_buffered = max(max_buffered, buffered);
+				stale_topics += it->second.stale_topics.size();
+				over_budget += it->second.over_budget;
+			}
+		}
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("send").begin_object();
+		writer.key("port").value(port);
+		writer.key("pushes").value((long long)send_stats.pushes);
+		writer.key("dropped").value((long long)send_stats.dropped);
+		writer.key("resyncs").value((long long)send_stats.resyncs);
+		writer.key("slow_disconnects").value((long long)send_stats.slow_disconnects);
+		writer.key("overflow_disconnects").value((long long)send_stats.overflow_disconnects);
+		writer.key("buffered_bytes").value((long long)total_buffered);
+		writer.key("max_buffered_bytes").value((long long)max_buffered);
+		writer.key("over_budget").value(over_budget);
+		writer.key("stale_topics").value((long long)stale_topics);
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
+
+	// send update of topic to hdl, or drop it if the connection is over its send budget or already owed
+	// a snapshot of the topic
+	void push(websocketpp::connection_hdl hdl, const string &topic, const string &update)
+	{
+		websocketpp::lib::error_code ec;
+		server::connection_ptr con = _server.get_con_from_hdl(hdl, ec);
+		if(ec)
+			return;
+
+		send_stats.pushes++;
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			auto it = connections.find(hdl);
+			if(it == connections.end())
+				return;
+
+			ConnectionState &state = it->second;
+			if(state.closing || state.stale_topics.count(topic))
+			{
+				send_stats.dropped++;
+				return;
+			}
+
+			if(con->get_buffered_amount() + update.size() > (size_t)Configuration::get_instance()->send_budget_bytes)
+			{
+				state.stale_topics.insert(topic);
+				if(!state.over_budget)
+				{
+					state.over_budget = true;
+					state.over_budget_since = chrono::steady_clock::now();
+				}
+				send_stats.dropped++;
+				return;
+			}
+		}
+
+		send(hdl, update, websocketpp::frame::opcode::text);
+	}
+
+	// push updates published on topic to hdl until it unsubscribes or closes
+	void subscribe(const string &topic, websocketpp::connection_hdl hdl)
+	{
+		Subscription subscription;
+		subscription.owner = this;
+		subscription.hdl = hdl;
+		subscription.send = [this, hdl, topic](const string &update){ push(hdl, topic, update); };
+		SubscriptionHub::get_instance()->subscribe(topic, subscription);
+	}
+
+	// a book id as Trading_Book and Deal have them, what a client sends is checked with it before any query
+	static bool is_book_id(const string &id)
+	{
+		return !id.empty() && id.size() <= 9 && id.find_first_not_of("0123456789") == string::npos;
+	}
+
+	// tell a client that sent a subscribe or unsubscribe with an id that it went through, {"<what>":"<topic>"}.
+	// Without an id nobody waits for it and nothing is sent.
+	void acknowledge(websocketpp::connection_hdl hdl, const Request &request, const string &what, const string &topic)
+	{
+		if(!request.has_id)
+			return;
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object().key(what).value(topic).end_object();
+		reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+	}
+
+	// answer request, text replies to a request with an id get it as a "#<id> " prefix.
+	// A client that let 4 budgets pile up is not reading, it is closed instead.
+	void reply(websocketpp::connection_hdl hdl, const Request &request, const string &payload, websocketpp::frame::opcode::value opcode)
+	{
+		websocketpp::lib::error_code ec;
+		server::connection_ptr con = _server.get_con_from_hdl(hdl, ec);
+		if(ec)
+			return;
+
+		if(con->get_buffered_amount() > 4 * (size_t)Configuration::get_instance()->send_budget_bytes)
+		{
+			{
+				lock_guard<mutex> lock(connections_mtx);
+				auto it = connections.find(hdl);
+				if(it == connections.end() || it->second.closing)
+					return;
+				it->second.closing = true;
+			}
+
+			_server.close(hdl, websocketpp::close::status::policy_violation, "send buffer overflow", ec);
+			send_stats.overflow_disconnects++;
+			return;
+		}
+
+		long long send_start = Metrics::now_ns();
+		if(!request.has_id || opcode != websocketpp::frame::opcode::text)
+			send(hdl, payload, opcode, "", opcode == websocketpp::frame::opcode::binary ? request.id_offset : string::npos, request.id);
+		else
+			send(hdl, payload, opcode, "#" + to_string(request.id) + " ");
+
+		long long send_end = Metrics::now_ns();
+		record(request, "send", send_end - send_start);
+		if(request.received_ns)
+			record(request, "total", send_end - request.received_ns);
+	}
+
+	// run work on the task scheduler instead of the io thread and send what it returns back to hdl as the
+	// reply to request. Requests with an id run side by side and each replies when it is done, the ones
+	// without wait for the connection's previous one to reply first.
+	void reply_async(server *s, websocketpp::connection_hdl hdl, const Request &request, websocketpp::frame::opcode::value opcode, TaskPriority priority, function<string()> work)
+	{
+		reply_deferred(s, hdl, request, opcode, priority, [work](function<void(shared_ptr<const string>)> respond){
+			respond(shared_ptr<const string>(new string(work())));
+		});
+	}
+
+	// as reply_async for work that may answer after it returns, through respond, e.g. once a build it waits
+	// for is done, so it does not hold a worker meanwhile. respond is called once, null when there is no
+	// result. A request that has no result or whose work throws gets {"error_msg":...} instead, so a client
+	// waiting on its id always hears back.
+	void reply_deferred(server*, websocketpp::connection_hdl hdl, const Request &request, websocketpp::frame::opcode::value opcode, TaskPriority priority, function<void(function<void(shared_ptr<const string>)>)> work)
+	{
+		bool ordered = !request.has_id;
+		function<void()> task = [this, hdl, request, opcode, work, ordered]{
+			long long start = Metrics::now_ns();
+			if(request.received_ns)
+				record(request, "queue", start - request.received_ns);
+
+			shared_ptr<atomic<bool>> responded(new atomic<bool>(false));
+			function<void(const string&)> fail = [this, hdl, request, ordered, responded](const string &error){
+				if(responded->exchange(true))
+					return;
+
+				JsonWriter &writer = JsonWriter::thread_writer();
+				writer.begin_object().key("error_msg").value(error).end_object();
+				reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+				if(ordered)
+					next_ordered(hdl);
+			};
+			function<void(shared_ptr<const string>)> respond = [this, hdl, request, opcode, ordered, responded, fail](shared_ptr<const string> response){
+				if(!response)
+				{
+					fail("no result for " + request.payload);
+					return;
+				}
+
+				if(responded->exchange(true))
+					return;
+
+				reply(hdl, request, *response, opcode);
+				if(ordered)
+					next_ordered(hdl);
+			};
+
+			Metrics::thread_db_ns() = 0;
+			try{
+				work(respond);
+			}catch(const std::exception &exc){
+				cout << "failed to answer " << request.payload << " because:" << exc.what() << endl;
+				fail("failed to answer " + request.payload + ": " + exc.what());
+			}catch(...){
+				cout << "failed to answer " << request.payload << endl;
+				fail("failed to answer " + request.payload);
+			}
+
+		long long handler_ns = Metrics::now_ns() - start;
+			long long db_ns = Metrics::thread_db_ns();
+			record(request, "handler", handler_ns);
+			record(request, "db", db_ns);
+			record(request, "compute", handler_ns - db_ns);
+		};
+
+		if(!ordered)
+		{
+			TaskScheduler::get_instance()->post(priority, task);
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			auto it = connections.find(hdl);
+			if(it == connections.end())
+				return; // closed meanwhile
+
+			if(it->second.ordered_running)
+			{
+				it->second.ordered.push_back(make_pair(priority, task));
+				return;
+			}
+			it->second.ordered_running = true;
+		}
+
+		TaskScheduler::get_instance()->post(priority, task);
 	}
+
+	// stop accepting and close every open connection, messages already received are still handled
+	void drain()
+	{
+		websocketpp::lib::error_code ec;
+		_server.stop_listening(ec);
+
+		vector<websocketpp::connection_hdl> open_connections;
+		{
+			lock_guard<mutex> lock(connections_mtx);
+			draining = true;
+			if(housekeeping_timer)
+				housekeeping_timer->cancel();
+
+			for(auto it = connections.begin(); it != connections.end(); ++it)
+				open_connections.push_back(it->first);
+		}
+
+		for(auto it = open_connections.begin(); it != open_connections.end(); ++it)
+			_server.close(*it, websocketpp::close::status::going_away, "server shutdown", ec);
+	}
+
+	virtual ~EndPoint(){}
 };
 
 #endif
@@ -2,171 +2,576 @@
 #define INIT_END_POINT_HPP
 
 #include "end_point.hpp"
+#include "init_snapshot.hpp"
+#include "chart_cache.hpp"
+#include "quote_store.hpp"
+#include "ticker_index.hpp"
+#include "deal_index.hpp"
+#include "position_keeper.hpp"
 #include "mysql.hpp"
+#include "quote_cache.hpp"
+#include "configuration.hpp"
+#include "json_writer.hpp"
+#include "binary_writer.hpp"
+#include "quote_validator.hpp"
+#include "date_util.hpp"
 #include <string>
 #include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+#include <memory>
 
 using namespace std;
 
+// Binary frames, for connections that sent "wire_format binary". All little-endian, every column starts
+// on a multiple of 8 bytes:
+//   u8 version, u8 frame type, u16 name length, name bytes, u32 request id (0 without one), u32 row count
+//   quotes (name is the ticker): i32 day[n] (days since 1970-01-01), f64 open[n], high[n], low[n], close[n]
+//   quote tail: as quotes, only the bars after the date the request gave, to append to the chart shown
+//   deals (name is the book id): u32 ticker count, (u16 length, bytes) per ticker,
+//                                u32 ticker index[n], i32 customer book[n], i32 day[n], f64 quantity[n]
+const uint8_t wire_version = 2;
+enum WireFrame
+{
+	WIRE_QUOTES = 1,
+	WIRE_DEALS = 2,
+	WIRE_QUOTE_TAIL = 3
+};
+
 class InitEndPoint: public EndPoint
 {
 private:
-	string deals;
-	string tickers;
-	string books;
-	string init_msg;
 
-	string get_deals_as_json(string book_id="1")
-        {
-                MysqlManager *mysql_manager = MysqlManager::get_instance();
-                sql::ResultSet* res = mysql_manager->executeQuery("select * from Deal where Book1_ID = " + book_id);
-		
-		string deals = "{\"book_id\":\"" + book_id + "\",\"deals\":[";
-                while(res->next())
-                {
-                        deals += "{\"ticker\":\"" + (res->getString("Ticker")) + "\",";
-                        deals += "\"quantity\":\"" + (res->getString("Quantity")) + "\",";
-                        deals += "\"date\":\"" + (res->getString("Date")) + "\"},";
-                }
+	void write_deals(JsonWriter &writer, string book_id)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select * from Deal where Book1_ID = ?", {book_id}));
 
-                deals.pop_back(); // get ride of the last comma 
-                deals += "]}";
+		writer.key("book_id").value(book_id);
+		writer.key("deals").begin_array();
+		while(res->next())
+		{
+			writer.begin_object();
+			writer.key("customer_book").value(res->getString("Book2_ID"));
+			writer.key("ticker").value(res->getString("Ticker"));
+			writer.key("quantity").value((long long)res->getInt64("Quantity"));
+			writer.key("date").value(res->getString("Date"));
+			writer.end_object();
+		}
+		writer.end_array();
+	}
+
+	void write_book_table(JsonWriter &writer, string table)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select * from " + table));
+
+		writer.begin_array();
+		while(res->next())
+		{
+			writer.begin_object();
+			writer.key("ID").value(res->getString("ID"));
+			writer.key("Name").value(res->getString("Name"));
+			writer.key("ParentID").value(res->getString("ParentID"));
+			writer.end_object();
+		}
+		writer.end_array();
+	}
 
-                return deals;
-        }	
+	void write_books(JsonWriter &writer)
+	{
+		writer.key("books").begin_object();
+		writer.key("trading_book");
+		write_book_table(writer, "Trading_Book");
+		writer.key("customer_book");
+		write_book_table(writer, "Customer_Book");
+		writer.end_object();
+	}
 
-	string get_tickers_as_json()
+	// one page of a book's deals from the deal index, with what it is a page of
+	void write_deals_page(JsonWriter &writer, const DealQuery &query)
 	{
-	        tickers = "{\"tickers\":[";
+		shared_ptr<const BookDeals> deals = DealIndex::get_instance()->get(query.book_id);
+		size_t total = 0;
+		vector<uint32_t> rows = DealIndex::page(*deals, query, total);
+
+		writer.key("book_id").value(query.book_id);
+		writer.key("page").value((long long)query.page);
+		writer.key("page_size").value((long long)query.page_size);
+		writer.key("total").value((long long)total);
+		writer.key("sort").value((query.descending ? "-" : "") + query.sort);
+		writer.key("ticker").value(query.ticker);
+		writer.key("deals").begin_array();
+		for(auto it = rows.begin(); it != rows.end(); ++it)
+		{
+			writer.begin_object();
+			writer.key("customer_book").value(to_string(deals->customer_book[*it]));
+			writer.key("ticker").value(deals->ticker[*it]);
+			writer.key("quantity").value(deals->quantity[*it]);
+			writer.key("date").value(format_day(deals->day[*it]));
+			writer.end_object();
+		}
+		writer.end_array();
+	}
 
-        	MysqlManager *mysql_manager = MysqlManager::get_instance();
-	        sql::ResultSet* res = mysql_manager->executeQuery("select distinct(Symbol) from Quotes");
+	string get_deals_page_as_json(const DealQuery &query)
+	{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		write_deals_page(writer, query);
+		writer.end_object();
 
-        	while(res->next())
-	        {
-        	        tickers += "\"" + (res->getString("Symbol")) + "\",";
-	        }
+		return writer.str();
+	}
 
-        	tickers.pop_back(); // get ride of the last comma
-	        tickers += "]}";
+	string get_deals_as_json(string book_id)
+	{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		write_deals(writer, book_id);
+		writer.end_object();
 
-        	return tickers;
+		return writer.str();
 	}
 
-	string get_quotes_as_json(string ticker)
+	// the deal rows of book_id the trades landed in, changed holds "<customer book> <ticker>" of each
+	string get_deal_updates_as_json(string book_id, const set<string> &changed)
 	{
-        	string query = "select Date, Open, High, Low, Close from Quotes where Symbol='" + ticker + "' order by Date";
-	        cout << query << endl;
-        	MysqlManager *mysql_manager = MysqlManager::get_instance();
-	        sql::ResultSet* res = mysql_manager->executeQuery(query);
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("deal_updates").begin_array();
+		for(auto it = changed.begin(); it != changed.end(); ++it)
+		{
+			string book2_id = it->substr(0, it->find(' ')), ticker = it->substr(it->find(' ') + 1);
+			unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Quantity, Date from Deal where Book1_ID = ? and Book2_ID = ? and Ticker = ?", {book_id, book2_id, ticker}));
+			if(!res->next())
+				continue;
+
+			writer.begin_object();
+			writer.key("book_id").value(book_id);
+			writer.key("customer_book").value(book2_id);
+			writer.key("ticker").value(ticker);
+			writer.key("quantity").value((long long)res->getInt64("Quantity"));
+			writer.key("date").value(res->getString("Date"));
+			writer.end_object();
+		}
+		writer.end_array();
+		writer.end_object();
 
-        	string quotes = "{\"ticker\":\"" + ticker + "\", \"quotes\":[";
-	        while(res->next())
-        	{
-                	quotes += "{\"date\":\"" + (res->getString("Date")) + "\",";
-	                quotes += "\"open\":\"" + (res->getString("Open")) + "\",";
-        	        quotes += "\"high\":\"" + (res->getString("High")) + "\",";
-                	quotes += "\"low\":\"" + (res->getString("Low")) + "\",";
-	                quotes += "\"close\":\"" + (res->getString("Close")) + "\"},";
-        	}
+		return writer.str();
+	}
 
-        	quotes.pop_back(); // get ride of the last comma 
-	        quotes += "]}";
+	// bars from index from on, from > 0 is the tail after since for a client that has the rest
+	string get_quotes_as_json(const QuoteBatch &quotes, size_t from, string since)
+	{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("ticker").value(quotes.symbol);
+		if(!since.empty())
+			writer.key("since").value(since);
+		writer.key("quotes").begin_array();
+		for(size_t i = from; i < quotes.size(); ++i)
+		{
+			writer.begin_object();
+			writer.key("date").value(format_day(quotes.day[i]));
+			writer.key("open").value(quotes.open[i]);
+			writer.key("high").value(quotes.high[i]);
+			writer.key("low").value(quotes.low[i]);
+			writer.key("close").value(quotes.close[i]);
+			writer.end_object();
+		}
+		writer.end_array();
+		writer.end_object();
 
-        	return quotes;
+		return writer.str();
 	}
 
-	string get_books_as_json()
+	void begin_frame(BinaryWriter &writer, WireFrame type, uint32_t request_id, const string &name, size_t n)
 	{
-        	MysqlManager *mysql_manager = MysqlManager::get_instance();
-	        books = "{\"books\":{\"trading_book\":[";
+		writer.u8(wire_version).u8(type);
+		writer.text(name).u32(request_id).u32(n);
+	}
 
-        	sql::ResultSet* res = mysql_manager->executeQuery("select * from Trading_Book");
+	string get_quotes_as_binary(const QuoteBatch &quotes, size_t from, WireFrame type, uint32_t request_id)
+	{
+		size_t n = quotes.size() - from;
+		BinaryWriter &writer = BinaryWriter::thread_writer();
+		begin_frame(writer, type, request_id, quotes.symbol, n);
+		writer.column(vector<int32_t>(quotes.day.begin() + from, quotes.day.end()));
+		if(from == 0)
+			writer.column(quotes.open).column(quotes.high).column(quotes.low).column(quotes.close);
+		else
+			writer.column(vector<double>(quotes.open.begin() + from, quotes.open.end())).column(vector<double>(quotes.high.begin() + from, quotes.high.end()))
+				.column(vector<double>(quotes.low.begin() + from, quotes.low.end())).column(vector<double>(quotes.close.begin() + from, quotes.close.end()));
+
+		return writer.str();
+	}
 
-	        while(res->next())
-        	{
-                	books += "{\"ID\":\"" + (res->getString("ID")) + "\",";
-	                books += "\"Name\":\"" + (res->getString("Name")) + "\",";
-        	        books += "\"ParentID\":\"" + (res->getString("ParentID")) + "\"},";
-	        }
+	string get_deals_as_binary(string book_id, uint32_t request_id)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select * from Deal where Book1_ID = ?", {book_id}));
+
+		vector<string> tickers;
+		unordered_map<string, uint32_t> ticker_index;
+		vector<uint32_t> ticker;
+		vector<int32_t> customer_book;
+		vector<int32_t> day;
+		vector<double> quantity;
+		while(res->next())
+		{
+			string symbol = res->getString("Ticker");
+			auto it = ticker_index.find(symbol);
+			if(it == ticker_index.end())
+			{
+				it = ticker_index.insert(make_pair(symbol, (uint32_t)tickers.size())).first;
+				tickers.push_back(symbol);
+			}
+
+			ticker.push_back(it->second);
+			customer_book.push_back(res->getInt("Book2_ID"));
+			day.push_back(parse_day(res->getString("Date")));
+			quantity.push_back(res->getInt64("Quantity"));
+		}
 
-        	books.pop_back(); // get ride of the last comma
-	        books += "], \"customer_book\":[";
+		BinaryWriter &writer = BinaryWriter::thread_writer();
+		begin_frame(writer, WIRE_DEALS, request_id, book_id, ticker.size());
+		writer.align(8).u32(tickers.size());
+		for(auto it = tickers.begin(); it != tickers.end(); ++it)
+			writer.text(*it);
+		writer.column(ticker).column(customer_book).column(day).column(quantity);
 
-        	res = mysql_manager->executeQuery("select * from Customer_Book");
+		return writer.str();
+	}
 
-	        while(res->next())
-        	{
-                	books += "{\"ID\":\"" + (res->getString("ID")) + "\",";
-	                books += "\"Name\":\"" + (res->getString("Name")) + "\",";
-        	        books += "\"ParentID\":\"" + (res->getString("ParentID")) + "\"},";
-	        }
+	// the chart of ticker from the chart cache, handed to done (null if it could not be built). Binary charts
+	// are cached with a request id of 0, the id is written into the copy that is sent (see chart_id_offset).
+	void get_chart(string ticker, bool binary, function<void(shared_ptr<const string>)> done)
+	{
+		string key = string(binary ? "binary" : "json") + ":daily:" + ticker;
+		ChartCache::get_instance()->get(key,
+			[ticker]{ return QuoteStore::version_of(ticker); },
+			[this, ticker, binary]{
+				shared_ptr<const QuoteBatch> quotes = QuoteStore::get_instance()->get(ticker);
+				return binary ? get_quotes_as_binary(*quotes, 0, WIRE_QUOTES, 0) : get_quotes_as_json(*quotes, 0, "");
+			},
+			done);
+	}
 
-        	books.pop_back(); // get ride of the last comma
-	        books += "]}}";
+	// where the request id sits in the binary chart of ticker, after version, type and the length prefixed symbol
+	static size_t chart_id_offset(const string &ticker)
+	{
+		return 4 + min(ticker.size(), (size_t)0xffff);
+	}
 
-        	return books;
+	// bars of ticker after since, found by binary search in the quote store, for a client that has the rest
+	string get_chart_tail(string ticker, string since, bool binary, uint32_t request_id)
+	{
+		shared_ptr<const QuoteBatch> quotes = QuoteStore::get_instance()->get(ticker);
+		size_t from = QuoteStore::first_after(*quotes, parse_day(since));
+		return binary ? get_quotes_as_binary(*quotes, from, WIRE_QUOTE_TAIL, request_id) : get_quotes_as_json(*quotes, from, since);
 	}
 
-	string merge_json(string json1, string json2)
+	// net quantity per ticker of a book from the position keeper, or from Deal when it is not loaded
+	vector<pair<string, double>> get_positions(string book_id, const DirtyTickers &changed)
 	{
-        	// get rid of the right parantheses and append comma of the first json
-	        json1.pop_back();
-        	json1 += ",";
+		vector<pair<string, double>> positions;
+		PositionKeeper *keeper = PositionKeeper::get_instance();
+		if(keeper->is_loaded())
+		{
+			PositionSnapshot snapshot = keeper->snapshot(book_id);
+			for(auto it = snapshot.quantities.begin(); it != snapshot.quantities.end(); ++it)
+				if(changed.all || changed.tickers.count(it->first))
+					positions.push_back(*it);
+
+			return positions;
+		}
 
-	        // get rid of the left paratheses
-        	json2.erase(0, 1);
+		string query = "select Ticker, sum(Quantity) as Quantity from Deal where Book1_ID = ?";
+		vector<string> params(1, book_id);
+		if(!changed.all)
+		{
+			query += " and Ticker in (";
+			for(auto it = changed.tickers.begin(); it != changed.tickers.end(); ++it)
+				query += it == changed.tickers.begin() ? "?" : ",?";
+			query += ")";
+			params.insert(params.end(), changed.tickers.begin(), changed.tickers.end());
+		}
+		query += " group by Ticker";
 
-	        return json1 + json2;
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery(query, params));
+		while(res->next())
+			positions.push_back(make_pair(res->getString("Ticker"), res->getDouble("Quantity")));
+
+		return positions;
 	}
 
-public:
-	InitEndPoint(int port):EndPoint(port)
+	// net quantity per ticker of a book, priced off the quote cache. Only the changed tickers unless
+	// everything is asked for; "" when the book holds none of them.
+	string get_positions_as_json(string book_id, const DirtyTickers &changed)
 	{
-		deals = "";
-		tickers = "";
-		books = "";
-		init_msg = "";
+		vector<pair<string, double>> positions = get_positions(book_id, changed);
+		if(!changed.all && positions.empty())
+			return "";
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("positions_update").begin_object();
+		writer.key("book_id").value(book_id);
+		writer.key("snapshot").value(changed.all); // snapshot replaces every position, otherwise only the listed ones change
+		writer.key("positions").begin_array();
+		CachedQuote quote;
+		for(auto it = positions.begin(); it != positions.end(); ++it)
+		{
+			const string &ticker = it->first;
+			double quantity = it->second;
+			writer.begin_object();
+			writer.key("ticker").value(ticker);
+			writer.key("quantity").value(quantity);
+			if(QuoteCache::get_instance()->get(ticker, quote))
+			{
+				writer.key("price").value(quote.price);
+				writer.key("market_value").value(quantity * quote.price);
+			}
+			writer.end_object();
+		}
+		writer.end_array();
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
 	}
 
-	void on_open(server *s, websocketpp::connection_hdl hdl)
+	// the first page of deals of the first book and the book trees in one message, tickers are searched
+	// for (search_tickers)
+	string get_init_as_json()
 	{
-		if(deals == "")
-			deals = get_deals_as_json();
+		DealQuery first_page;
+		first_page.book_id = "1";
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		write_deals_page(writer, first_page);
+		write_books(writer);
+		writer.end_object();
 
-		if(tickers == "") 
-                	tickers = get_tickers_as_json();
+		return writer.str();
+	}
+
+	string get_ticker_search_as_json(string query)
+	{
+		vector<TickerMatch> matches = TickerIndex::get_instance()->search(query, Configuration::get_instance()->search_results);
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("ticker_search").begin_object();
+		writer.key("query").value(query);
+		writer.key("results").begin_array();
+		for(auto it = matches.begin(); it != matches.end(); ++it)
+		{
+			writer.begin_object();
+			writer.key("symbol").value(it->symbol);
+			writer.key("name").value(it->name);
+			writer.end_object();
+		}
+		writer.end_array();
+		writer.end_object();
+		writer.end_object();
 
-	        if(books == "") 
-        	        books = get_books_as_json();
+		return writer.str();
+	}
 
-	        if(init_msg == "") 
+	// msg_val is a comma separated ticker list, prices come from the quote cache the poller keeps fresh
+	string get_latest_quotes_as_json(string tickers_list)
+	{
+		vector<string> tickers;
+		stringstream ss(tickers_list);
+		string ticker;
+		while(getline(ss, ticker, ','))
+			tickers.push_back(ticker);
+
+		chrono::seconds max_age(Configuration::get_instance()->quote_poll_seconds);
+		unordered_map<string, double> prices = QuoteCache::get_instance()->get_fresh(tickers, max_age);
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("latest_quotes").begin_object();
+		CachedQuote quote;
+		for(auto it = prices.begin(); it != prices.end(); ++it)
 		{
-			init_msg = merge_json(deals, tickers);
-        	        init_msg = merge_json(init_msg, books);
+			QuoteCache::get_instance()->get(it->first, quote);
+			writer.key(it->first).begin_object();
+			writer.key("price").value(it->second);
+			writer.key("time").value(quote.trade_time);
+			writer.end_object();
 		}
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
 
-	        s->send(hdl, init_msg, websocketpp::frame::opcode::text);
+public:
+	InitEndPoint(int port, int n_threads = 0):EndPoint(port, n_threads)
+	{
+		// positions:<book id>, refreshed for the tickers a trade or a quote update touched
+		SubscriptionHub::get_instance()->set_refresher("positions", [this](const string &topic, const DirtyTickers &changed){
+			return get_positions_as_json(topic.substr(topic.find(':') + 1), changed);
+		}, INTERACTIVE);
+
+		// deals:<book id> is invalidated with "<customer book> <ticker>" of the rows trades landed in, which
+		// are read back in the refresh, so a newer total is never published before an older one. A subscriber
+		// that fell behind only hears that the deals changed and asks for the page it shows again, rather
+		// than getting a book of tens of thousands of deals it would throw away.
+		SubscriptionHub::get_instance()->set_refresher("deals", [this](const string &topic, const DirtyTickers &changed){
+			string book_id = topic.substr(topic.find(':') + 1);
+			if(!changed.all)
+				return get_deal_updates_as_json(book_id, changed.tickers);
+
+			JsonWriter &writer = JsonWriter::thread_writer();
+			writer.begin_object().key("deals_changed").begin_object().key("book_id").value(book_id).end_object().end_object();
+			return writer.str();
+		}, INTERACTIVE);
+
+		InitSnapshot::get_instance()->set_builder([this]{ return get_init_as_json(); });
+		TickerIndex::get_instance()->warm_up();
 	}
 
-	void on_message(server *s, websocketpp::connection_hdl hdl, server::message_ptr msg)
+	// the prebuilt init message, sent from the task scheduler as compressing it is the only work left
+	void on_open(server*, websocketpp::connection_hdl hdl)
 	{
-		stringstream ss(msg->get_payload());
+		InitSnapshot::get_instance()->with_current([this, hdl](shared_ptr<const string> init_msg){
+			TaskScheduler::get_instance()->post(INTERACTIVE, [this, hdl, init_msg]{
+				send(hdl, *init_msg, websocketpp::frame::opcode::text);
+			});
+		});
+	}
+
+	void on_message(server *s, websocketpp::connection_hdl hdl, const Request &request)
+	{
+		stringstream ss(request.payload);
                 string msg_type, msg_val;
                 ss >> msg_type >> msg_val;
+		vector<string> args(1, msg_val); // msg_val and whatever follows it
+		string arg;
+		while(ss >> arg)
+			args.push_back(arg);
 
-		string response = "";
+		if(msg_type=="scheduler_stats")
+		{
+			reply(hdl, request, TaskScheduler::get_instance()->stats_as_json(), websocketpp::frame::opcode::text);
+			return;
+		}
 
-		if(msg_type=="ticker_for_chart")
+		if(msg_type=="wire_format")
+		{
+			set_binary(hdl, msg_val == "binary");
+			JsonWriter &writer = JsonWriter::thread_writer();
+			writer.begin_object().key("wire_format").value(msg_val == "binary" ? "binary" : "json").end_object();
+			reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+			return;
+		}
+
+		// deals and positions are per book, anything but a book id is refused before it gets near a query
+		if((msg_type=="subscribe_deals" || msg_type=="book_id_for_deals" || msg_type=="subscribe_positions") && !is_book_id(msg_val))
 		{
-			response = get_quotes_as_json(msg_val); // msg_val is a ticker
+			JsonWriter &writer = JsonWriter::thread_writer();
+			writer.begin_object().key("error_msg").value("bad book id: " + request.payload).end_object();
+			reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+			return;
 		}
-		else if(msg_type=="book_id_for_deals")
+
+		// the deal table follows trades booked into the book from now on: the current deals, then deal_updates with the rows trades change
+		if(msg_type=="subscribe_deals")
+		{
+			subscribe("deals:" + msg_val, hdl);
+			msg_type = "book_id_for_deals";
+		}
+
+		// book_id_for_deals <book id> <page> [page size] [ticker|quantity|date, - in front for descending] [ticker]
+		// lists one page, sorted and filtered by the server. Without a page it is every deal, as before.
+		if(msg_type=="book_id_for_deals" && args.size() > 1)
+		{
+			DealQuery query;
+			if(!query.parse(args))
+			{
+				JsonWriter &writer = JsonWriter::thread_writer();
+				writer.begin_object().key("error_msg").value("bad deal listing: " + request.payload).end_object();
+				reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+				return;
+			}
+
+			reply_async(s, hdl, request, websocketpp::frame::opcode::text, INTERACTIVE, [this, query]{
+				return get_deals_page_as_json(query);
+			});
+			return;
+		}
+
+		// positions_update with every position of the book, then one per change
+		if(msg_type=="subscribe_positions")
+		{
+			subscribe("positions:" + msg_val, hdl);
+			acknowledge(hdl, request, "subscribed", "positions:" + msg_val);
+			SubscriptionHub::get_instance()->invalidate("positions:" + msg_val);
+			return;
+		}
+
+		// search_tickers <prefix of a symbol or of a word of a company name, may be empty>, answered in memory
+		if(msg_type=="search_tickers")
+		{
+			string query = request.payload.size() > msg_type.size() ? request.payload.substr(msg_type.size() + 1) : "";
+			reply(hdl, request, get_ticker_search_as_json(query), websocketpp::frame::opcode::text);
+			return;
+		}
+
+		if(msg_type=="ticker_for_chart")
+			TickerIndex::get_instance()->charted(msg_val);
+
+		// ticker_for_chart <ticker> [yyyy-mm-dd] only sends the bars after the date when there is one
+		string since = args.size() > 1 ? args[1] : "";
+		if(parse_day(since) < 0)
+			since = "";
+
+		// charts and deal tables go out as binary frames to connections that asked for them
+		bool binary = is_binary(hdl) && (msg_type=="ticker_for_chart" || msg_type=="book_id_for_deals");
+		websocketpp::frame::opcode::value opcode = binary ? websocketpp::frame::opcode::binary : request.opcode;
+		uint32_t request_id = request.id;
+
+		// a chart another request is building already is sent when that build is done, no worker waits for it
+		if(msg_type=="ticker_for_chart" && since.empty())
 		{
-			response = get_deals_as_json(msg_val); // msg_val is a book id
+			Request chart_request = request;
+			if(binary)
+				chart_request.id_offset = chart_id_offset(msg_val);
+
+			reply_deferred(s, hdl, chart_request, opcode, INTERACTIVE, [this, msg_val, binary](function<void(shared_ptr<const string>)> respond){
+				get_chart(msg_val, binary, respond); // msg_val is a ticker
+			});
+			return;
 		}
 
-	        s->send(hdl, response, msg->get_opcode());
+		reply_async(s, hdl, request, opcode, INTERACTIVE, [this, msg_type, msg_val, since, binary, request_id]{
+			string response = "";
+
+			if(msg_type=="ticker_for_chart")
+			{
+				response = get_chart_tail(msg_val, since, binary, request_id); // msg_val is a ticker
+			}
+			else if(msg_type=="book_id_for_deals")
+			{
+				response = binary ? get_deals_as_binary(msg_val, request_id) : get_deals_as_json(msg_val); // msg_val is a book id
+			}
+			else if(msg_type=="latest_quotes")
+			{
+				response = get_latest_quotes_as_json(msg_val);
+			}
+
+			return response;
+		});
 	}
 };
 
@@ -0,0 +1,190 @@
+#ifndef INIT_SNAPSHOT_HPP
+#define INIT_SNAPSHOT_HPP
+
+#include "task_scheduler.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+// The init message every new connection gets, serialized once and shared by all of them. Trades invalidate
+// it and a rebuild is queued on the task scheduler, invalidations while one runs fold into one more rebuild.
+// Tables nothing in the server writes to (Quotes, the book tables) are caught by rebuilding every
+// refresh period. The version goes up only when the content actually changed, and is sent as "init_version".
+class InitSnapshot
+{
+private:
+	static InitSnapshot *instance;
+
+	mutex mtx;
+	function<string()> builder; // the init message, a json object
+	shared_ptr<const string> current;
+	long long version;
+	size_t content_hash; // of what builder returned for current
+	bool rebuilding;
+	bool dirty; // invalidated while rebuilding
+	vector<function<void(shared_ptr<const string>)>> waiting; // asked before the first build finished
+
+	chrono::seconds refresh_period;
+	bool running;
+	condition_variable stopped;
+	thread refresher;
+
+	InitSnapshot():version(0), content_hash(0), rebuilding(false), dirty(false), refresh_period(0), running(false){}
+
+	void rebuild()
+	{
+		function<string()> build;
+		{
+			lock_guard<mutex> lock(mtx);
+			dirty = false;
+			build = builder;
+		}
+
+		string content;
+		try{
+			content = build();
+		}catch(const std::exception &exc){
+			cout << "failed to build the init message because:" << exc.what() << endl;
+		}
+
+		vector<function<void(shared_ptr<const string>)>> ready;
+		shared_ptr<const string> snapshot;
+		bool again;
+		{
+			lock_guard<mutex> lock(mtx);
+			size_t hash = std::hash<string>()(content);
+			if(content.size() > 2 && (!current || hash != content_hash))
+			{
+				++version;
+				content_hash = hash;
+				current.reset(new string("{\"init_version\":" + to_string(version) + "," + content.substr(1)));
+			}
+
+			snapshot = current;
+			if(snapshot)
+				ready.swap(waiting);
+
+			again = dirty;
+			rebuilding = again;
+		}
+
+		for(auto it = ready.begin(); it != ready.end(); ++it)
+			(*it)(snapshot);
+
+		if(again)
+			TaskScheduler::get_instance()->post(BATCH, [this]{ rebuild(); });
+	}
+
+	void refresh()
+	{
+		unique_lock<mutex> lock(mtx);
+		while(running)
+		{
+			if(stopped.wait_for(lock, refresh_period, [this]{ return !running; }))
+				break;
+
+			lock.unlock();
+			invalidate();
+			lock.lock();
+		}
+	}
+
+public:
+	static InitSnapshot* get_instance()
+	{
+		if(!instance)
+			instance = new InitSnapshot();
+
+		return instance;
+	}
+
+	// what to build the message with, the first build is queued right away
+	void set_builder(function<string()> build)
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			builder = build;
+		}
+
+		invalidate();
+	}
+
+	// queue a rebuild, or one more after the rebuild running now
+	void invalidate()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			if(!builder)
+				return;
+
+			if(rebuilding)
+			{
+				dirty = true;
+				return;
+			}
+
+			rebuilding = true;
+		}
+
+		TaskScheduler::get_instance()->post(BATCH, [this]{ rebuild(); });
+	}
+
+	// call use with the current message, or with the first one once it is built
+	void with_current(function<void(shared_ptr<const string>)> use)
+	{
+		shared_ptr<const string> snapshot;
+		{
+			lock_guard<mutex> lock(mtx);
+			if(!current)
+			{
+				waiting.push_back(use);
+				return;
+			}
+			snapshot = current;
+		}
+
+		use(snapshot);
+	}
+
+	long long get_version()
+	{
+		lock_guard<mutex> lock(mtx);
+		return version;
+	}
+
+	// rebuild every period to pick up tables changed outside the server
+	void start(chrono::seconds period)
+	{
+		lock_guard<mutex> lock(mtx);
+		if(running || period.count() <= 0)
+			return;
+
+		refresh_period = period;
+		running = true;
+		refresher = thread(&InitSnapshot::refresh, this);
+	}
+
+	void stop()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			running = false;
+			stopped.notify_all();
+		}
+
+		if(refresher.joinable())
+			refresher.join();
+	}
+};
+
+InitSnapshot *InitSnapshot::instance = NULL;
+
+#endif
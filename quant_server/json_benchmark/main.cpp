@@ -0,0 +1,185 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include "json_writer.hpp"
+#include "binary_writer.hpp"
+#include "date_util.hpp"
+
+using namespace std;
+
+// compares the old string concatenation json code of the end points against JsonWriter and the
+// binary frames on synthetic quote histories, usage: ./json_benchmark [n_quotes] [n_rounds]
+
+struct QuoteRow
+{
+	string date;
+	double open;
+	double high;
+	double low;
+	double close;
+};
+
+// the result set hands every column over as text
+struct LegacyQuoteRow
+{
+	string date;
+	string open;
+	string high;
+	string low;
+	string close;
+};
+
+vector<QuoteRow> make_quotes(int n)
+{
+	vector<QuoteRow> quotes;
+	quotes.reserve(n);
+	double price = 100;
+	srand(42);
+	for(int i = 0; i < n; ++i)
+	{
+		price = floor(price * (1 + (rand() % 200 - 100) / 10000.0) * 100 + 0.5) / 100; // quotes are in cents
+		char date[16];
+		snprintf(date, sizeof(date), "%04d-%02d-%02d", 1990 + i / 365, i % 12 + 1, i % 28 + 1);
+		quotes.push_back(QuoteRow{date, price, price * 1.01, price * 0.99, price * 1.002});
+	}
+
+	return quotes;
+}
+
+string legacy_quotes_as_json(string ticker, const vector<LegacyQuoteRow> &quotes)
+{
+	string quotes_as_json = "{\"ticker\":\"" + ticker + "\",\"quotes\":[";
+	for(auto it = quotes.begin(); it != quotes.end(); ++it)
+	{
+		quotes_as_json += "{\"date\":\"" + it->date + "\",";
+		quotes_as_json += "\"open\":\"" + it->open + "\",";
+		quotes_as_json += "\"high\":\"" + it->high + "\",";
+		quotes_as_json += "\"low\":\"" + it->low + "\",";
+		quotes_as_json += "\"close\":\"" + it->close + "\"},";
+	}
+
+	quotes_as_json.pop_back(); // get ride of the last comma 
+	quotes_as_json += "]}";
+
+	return quotes_as_json;
+}
+
+// init message used to be three documents glued together
+string legacy_merge_json(string json1, string json2)
+{
+	json1.pop_back();
+	json2.erase(0, 1);
+
+	return json1 + "," + json2;
+}
+
+// quotes coming from the db as text, prices parsed the way the driver's getDouble would
+string writer_quotes_as_json(string ticker, const vector<LegacyQuoteRow> &quotes)
+{
+	JsonWriter &writer = JsonWriter::thread_writer();
+	writer.begin_object();
+	writer.key("ticker").value(ticker);
+	writer.key("quotes").begin_array();
+	for(auto it = quotes.begin(); it != quotes.end(); ++it)
+	{
+		writer.begin_object();
+		writer.key("date").value(it->date);
+		writer.key("open").value(strtod(it->open.c_str(), NULL));
+		writer.key("high").value(strtod(it->high.c_str(), NULL));
+		writer.key("low").value(strtod(it->low.c_str(), NULL));
+		writer.key("close").value(strtod(it->close.c_str(), NULL));
+		writer.end_object();
+	}
+	writer.end_array();
+	writer.end_object();
+
+	return writer.str();
+}
+
+template<typename Function>
+double time_ms(int n_rounds, size_t &bytes, Function function)
+{
+	auto start = chrono::steady_clock::now();
+	for(int round = 0; round < n_rounds; ++round)
+		bytes += function().size();
+
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / n_rounds;
+}
+
+int main(int argc, char *argv[])
+{
+	int n_quotes = argc > 1 ? atoi(argv[1]) : 10000;
+	int n_rounds = argc > 2 ? atoi(argv[2]) : 50;
+
+	vector<QuoteRow> quotes = make_quotes(n_quotes);
+	// the db hands every column over as text, the mysql driver keeps DOUBLE values that way
+	vector<LegacyQuoteRow> text_quotes;
+	char num[32];
+	for(auto it = quotes.begin(); it != quotes.end(); ++it)
+	{
+		LegacyQuoteRow row;
+		row.date = it->date;
+		row.open.assign(num, JsonWriter::format_double(it->open, num));
+		row.high.assign(num, JsonWriter::format_double(it->high, num));
+		row.low.assign(num, JsonWriter::format_double(it->low, num));
+		row.close.assign(num, JsonWriter::format_double(it->close, num));
+		text_quotes.push_back(row);
+	}
+
+	size_t legacy_bytes = 0, text_bytes = 0, double_bytes = 0, risk_bytes = 0, binary_bytes = 0;
+	double legacy_ms = time_ms(n_rounds, legacy_bytes, [&]{
+		return legacy_merge_json(legacy_quotes_as_json("AAPL", text_quotes), "{\"tickers\":[\"AAPL\"]}");
+	});
+	double text_ms = time_ms(n_rounds, text_bytes, [&]{
+		return writer_quotes_as_json("AAPL", text_quotes);
+	});
+	// the old risk reply formatted each value with to_string
+	double risk_ms = time_ms(n_rounds, risk_bytes, [&]{
+		string json = "{";
+		for(auto it = quotes.begin(); it != quotes.end(); ++it)
+			json += "\"" + it->date + "\":[\"" + to_string(it->open) + "\",\"" + to_string(it->high) + "\",\"" + to_string(it->low) + "\",\"" + to_string(it->close) + "\"],";
+		json.pop_back();
+		return json + "}";
+	});
+	double double_ms = time_ms(n_rounds, double_bytes, [&]{
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		for(auto it = quotes.begin(); it != quotes.end(); ++it)
+			writer.key(it->date).begin_array().value(it->open).value(it->high).value(it->low).value(it->close).end_array();
+		writer.end_object();
+		return writer.str();
+	});
+	// chart frame as get_quotes_as_binary builds it, dates parsed from the db text
+	double binary_ms = time_ms(n_rounds, binary_bytes, [&]{
+		vector<int32_t> day;
+		vector<double> open, high, low, close;
+		for(auto it = quotes.begin(); it != quotes.end(); ++it)
+		{
+			day.push_back(parse_day(it->date));
+			open.push_back(it->open);
+			high.push_back(it->high);
+			low.push_back(it->low);
+			close.push_back(it->close);
+		}
+
+		BinaryWriter &writer = BinaryWriter::thread_writer();
+		writer.u8(2).u8(1).text("AAPL").u32(0).u32(day.size());
+		writer.column(day).column(open).column(high).column(low).column(close);
+		return writer.str();
+	});
+
+	cout << n_quotes << " quotes, " << n_rounds << " rounds" << endl;
+	cout << "db text, string concat:  " << legacy_ms << " ms, " << legacy_bytes / n_rounds << " bytes" << endl;
+	cout << "db text, json writer:    " << text_ms << " ms, " << text_bytes / n_rounds << " bytes" << endl;
+	cout << "doubles, to_string:      " << risk_ms << " ms, " << risk_bytes / n_rounds << " bytes" << endl;
+	cout << "doubles, json writer:    " << double_ms << " ms, " << double_bytes / n_rounds << " bytes" << endl;
+	cout << "binary frame:            " << binary_ms << " ms, " << binary_bytes / n_rounds << " bytes" << endl;
+	cout << "speedup on db text:      " << legacy_ms / text_ms << "x" << endl;
+	cout << "speedup on doubles:      " << risk_ms / double_ms << "x" << endl;
+	cout << "binary vs string concat: " << legacy_ms / binary_ms << "x faster, " << (double)legacy_bytes / binary_bytes << "x smaller" << endl;
+
+	return 0;
+}
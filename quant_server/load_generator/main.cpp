@@ -0,0 +1,424 @@
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include "metrics.hpp"
+
+using namespace std;
+
+// Opens clients against the init (9002), booking (9003) and risk (9004) end points and sends a mix of
+// chart, deal table, booking and risk report requests at fixed rates, then reports throughput and latency
+// per request type. usage: ./load_generator [key=value ...], see Options for the keys.
+//
+// Requests go out on schedule whether or not earlier ones were answered, and latency is measured from
+// when a request was due rather than when it went out, so a server falling behind shows up in the
+// percentiles instead of slowing the generator down. Bookings are real trades, point books= at test books.
+
+typedef websocketpp::client<websocketpp::config::asio_client> client;
+
+struct Options
+{
+	string host;
+	int seconds; // of sending, then up to drain_seconds waiting for replies
+	int drain_seconds;
+	int clients; // per end point
+	int threads;
+	double chart_rate; // requests per second
+	double deals_rate;
+	double booking_rate;
+	double basket_rate;
+	int basket_size; // trades per basket booking
+	double risk_rate;
+	vector<string> tickers;
+	vector<string> books; // trading books, deal tables and risk reports are asked for and trades booked into
+	vector<string> customer_books;
+	string report;
+	bool binary; // charts and deal tables as binary frames
+
+	Options():host("127.0.0.1"), seconds(30), drain_seconds(5), clients(10), threads(2), chart_rate(20), deals_rate(10), booking_rate(1), basket_rate(0), basket_size(10000), risk_rate(0.5), report("VarianceCovarianceVAR"), binary(false)
+	{
+		tickers.push_back("AAPL");
+		tickers.push_back("MSFT");
+		tickers.push_back("GOOG");
+		books.push_back("1");
+		customer_books.push_back("2");
+	}
+};
+
+vector<string> split(const string &s, char delimiter)
+{
+	vector<string> parts;
+	stringstream ss(s);
+	string part;
+	while(getline(ss, part, delimiter))
+		if(!part.empty())
+			parts.push_back(part);
+
+	return parts;
+}
+
+bool parse_options(int argc, char **argv, Options &options)
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		size_t eq = arg.find('=');
+		if(eq == string::npos)
+			return false;
+
+		string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+		if(key == "host") options.host = value;
+		else if(key == "seconds") options.seconds = atoi(value.c_str());
+		else if(key == "drain_seconds") options.drain_seconds = atoi(value.c_str());
+		else if(key == "clients") options.clients = atoi(value.c_str());
+		else if(key == "threads") options.threads = atoi(value.c_str());
+		else if(key == "chart") options.chart_rate = atof(value.c_str());
+		else if(key == "deals") options.deals_rate = atof(value.c_str());
+		else if(key == "booking") options.booking_rate = atof(value.c_str());
+		else if(key == "basket") options.basket_rate = atof(value.c_str());
+		else if(key == "basket_size") options.basket_size = atoi(value.c_str());
+		else if(key == "risk") options.risk_rate = atof(value.c_str());
+		else if(key == "tickers") options.tickers = split(value, ',');
+		else if(key == "books") options.books = split(value, ',');
+		else if(key == "customer_books") options.customer_books = split(value, ',');
+		else if(key == "report") options.report = value;
+		else if(key == "binary") options.binary = value == "1";
+		else
+			return false;
+	}
+
+	return options.clients > 0 && options.basket_size > 0 && options.threads > 0 && !options.tickers.empty() && !options.books.empty() && !options.customer_books.empty();
+}
+
+// one kind of request, sent at rate per second to the end point on port
+struct MessageType
+{
+	string name;
+	int port;
+	double rate;
+	function<string(size_t)> make_payload; // the n-th request
+	size_t n;
+	long long next_due_ns;
+	Histogram latency;
+	atomic<long long> sent;
+	atomic<long long> completed;
+
+	MessageType(const string &name, int port, double rate, function<string(size_t)> make_payload):name(name), port(port), rate(rate), make_payload(make_payload), n(0), next_due_ns(0), sent(0), completed(0){}
+};
+
+// a request waiting for its reply
+struct Pending
+{
+	MessageType *type;
+	long long due_ns;
+};
+
+struct Connection
+{
+	int port;
+	websocketpp::connection_hdl hdl;
+	bool open;
+	mutex mtx;
+	unordered_map<uint32_t, Pending> pending; // by request id
+
+	Connection(int port):port(port), open(false){}
+};
+
+class LoadGenerator
+{
+private:
+	static const long tick_ms = 1;
+
+	Options options;
+	client _client;
+	vector<unique_ptr<Connection>> connections;
+	vector<unique_ptr<MessageType>> types;
+	map<int, size_t> next_connection; // round robin per port
+	atomic<uint32_t> next_id;
+	atomic<int> n_open;
+	long long start_ns;
+	long long stop_ns;
+
+	void on_open(Connection *connection, websocketpp::connection_hdl hdl)
+	{
+		{
+			lock_guard<mutex> lock(connection->mtx);
+			connection->open = true;
+		}
+		n_open++;
+
+		if(options.binary && connection->port == 9002)
+			_client.send(hdl, "wire_format binary", websocketpp::frame::opcode::text);
+	}
+
+	void on_close(Connection *connection, websocketpp::connection_hdl)
+	{
+		lock_guard<mutex> lock(connection->mtx);
+		if(connection->open)
+			n_open--;
+		connection->open = false;
+	}
+
+	// replies carry the request id, "#<id> " in front of text and in the header of binary frames.
+	// Anything else (the init message, pushed updates) is not a reply.
+	void on_message(Connection *connection, websocketpp::connection_hdl, client::message_ptr msg)
+	{
+		long long now = Metrics::now_ns();
+		const string &payload = msg->get_payload();
+		uint32_t id;
+		if(msg->get_opcode() == websocketpp::frame::opcode::binary)
+		{
+			// u8 version, u8 type, u16 name length, name, u32 request id
+			if(payload.size() < 4)
+				return;
+			size_t name_length = (unsigned char)payload[2] | (unsigned char)payload[3] << 8;
+			if(payload.size() < 8 + name_length)
+				return;
+			const unsigned char *p = (const unsigned char*)payload.data() + 4 + name_length;
+			id = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+		}
+		else
+		{
+			if(payload.empty() || payload[0] != '#')
+				return;
+			id = strtoul(payload.c_str() + 1, NULL, 10);
+		}
+
+		Pending pending;
+		{
+			lock_guard<mutex> lock(connection->mtx);
+			auto it = connection->pending.find(id);
+			if(it == connection->pending.end())
+				return;
+			pending = it->second;
+			connection->pending.erase(it);
+		}
+
+		pending.type->latency.record(now - pending.due_ns);
+		pending.type->completed++;
+	}
+
+	Connection* pick(int port)
+	{
+		size_t &next = next_connection[port];
+		for(size_t tried = 0; tried < connections.size(); ++tried)
+		{
+			Connection *connection = connections[next++ % connections.size()].get();
+			if(connection->port == port && connection->open)
+				return connection;
+		}
+
+		return NULL;
+	}
+
+	void send(MessageType &type, long long due_ns)
+	{
+		Connection *connection = pick(type.port);
+		if(!connection)
+			return;
+
+		uint32_t id = next_id++;
+		{
+			lock_guard<mutex> lock(connection->mtx);
+			connection->pending[id] = Pending{&type, due_ns};
+		}
+
+		websocketpp::lib::error_code ec;
+		_client.send(connection->hdl, "#" + to_string(id) + " " + type.make_payload(type.n++), websocketpp::frame::opcode::text, ec);
+		if(!ec)
+			type.sent++;
+	}
+
+	// sends everything that fell due since the last tick, only one tick is ever pending
+	void tick(const websocketpp::lib::error_code &ec)
+	{
+		if(ec)
+			return;
+
+		long long now = Metrics::now_ns();
+		if(now >= stop_ns)
+			return;
+
+		for(auto it = types.begin(); it != types.end(); ++it)
+		{
+			MessageType &type = **it;
+			if(type.rate <= 0)
+				continue;
+
+			long long interval = 1e9 / type.rate;
+			while(type.next_due_ns <= now)
+			{
+				send(type, type.next_due_ns);
+				type.next_due_ns += interval;
+			}
+		}
+
+		_client.set_timer(tick_ms, bind(&LoadGenerator::tick, this, websocketpp::lib::placeholders::_1));
+	}
+
+	long long outstanding()
+	{
+		long long n = 0;
+		for(auto it = types.begin(); it != types.end(); ++it)
+			n += (*it)->sent - (*it)->completed;
+
+		return n;
+	}
+
+	void report(double elapsed_seconds)
+	{
+		printf("\n%-22s %8s %8s %8s %9s %9s %9s %9s %9s %9s\n", "type", "sent", "done", "lost", "done/s", "p50 ms", "p90 ms", "p99 ms", "p999 ms", "max ms");
+		for(auto it = types.begin(); it != types.end(); ++it)
+		{
+			MessageType &type = **it;
+			if(type.rate <= 0)
+				continue;
+
+			const Histogram &h = type.latency;
+			printf("%-22s %8lld %8lld %8lld %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f\n", type.name.c_str(), (long long)type.sent, (long long)type.completed, (long long)(type.sent - type.completed),
+				type.completed / elapsed_seconds, h.percentile_ns(0.5) / 1e6, h.percentile_ns(0.9) / 1e6, h.percentile_ns(0.99) / 1e6, h.percentile_ns(0.999) / 1e6, h.max_ns() / 1e6);
+			if(type.name == "basket")
+				printf("%-22s %.1f trades/s in baskets of %d\n", "", type.completed * options.basket_size / elapsed_seconds, options.basket_size);
+		}
+	}
+
+public:
+	LoadGenerator(const Options &options):options(options), next_id(1), n_open(0), start_ns(0), stop_ns(0)
+	{
+		const Options &o = this->options;
+		types.push_back(unique_ptr<MessageType>(new MessageType("ticker_for_chart", 9002, o.chart_rate, [&o](size_t n){
+			return "ticker_for_chart " + o.tickers[n % o.tickers.size()];
+		})));
+		types.push_back(unique_ptr<MessageType>(new MessageType("book_id_for_deals", 9002, o.deals_rate, [&o](size_t n){
+			return "book_id_for_deals " + o.books[n % o.books.size()];
+		})));
+
+		char today[16];
+		time_t now = time(NULL);
+		strftime(today, sizeof(today), "%Y-%m-%d", localtime(&now));
+		string date = today;
+		types.push_back(unique_ptr<MessageType>(new MessageType("booking", 9003, o.booking_rate, [&o, date](size_t n){
+			// buy and sell in turns so the books end up where they started
+			string quantity = n % 2 ? "-100" : "100";
+			return o.books[n / 2 % o.books.size()] + " " + o.customer_books[n / 2 % o.customer_books.size()] + " " + o.tickers[n / 2 % o.tickers.size()] + " " + quantity + " " + date;
+		})));
+		// a whole portfolio upload in one message, it nets out like the single bookings
+		string basket = "basket ";
+		for(int i = 0; i < o.basket_size; ++i)
+		{
+			string quantity = i % 2 ? "-100" : "100";
+			basket += (i ? ";" : "") + o.books[i / 2 % o.books.size()] + " " + o.customer_books[i / 2 % o.customer_books.size()] + " " + o.tickers[i / 2 % o.tickers.size()] + " " + quantity + " " + date;
+		}
+		types.push_back(unique_ptr<MessageType>(new MessageType("basket", 9003, o.basket_rate, [basket](size_t){
+			return basket;
+		})));
+		types.push_back(unique_ptr<MessageType>(new MessageType(o.report, 9004, o.risk_rate, [&o](size_t n){
+			return o.report + " " + o.books[n % o.books.size()];
+		})));
+
+		_client.clear_access_channels(websocketpp::log::alevel::all);
+		_client.clear_error_channels(websocketpp::log::elevel::all);
+		_client.init_asio();
+	}
+
+	bool run()
+	{
+		int ports[] = {9002, 9003, 9004};
+		for(int p = 0; p < 3; ++p)
+		{
+			bool used = false;
+			for(auto it = types.begin(); it != types.end(); ++it)
+				used |= (*it)->port == ports[p] && (*it)->rate > 0;
+			if(!used)
+				continue;
+
+			for(int i = 0; i < options.clients; ++i)
+			{
+				Connection *connection = new Connection(ports[p]);
+				connections.push_back(unique_ptr<Connection>(connection));
+
+				websocketpp::lib::error_code ec;
+				client::connection_ptr con = _client.get_connection("ws://" + options.host + ":" + to_string(ports[p]), ec);
+				if(ec)
+				{
+					cout << "failed to connect to " << ports[p] << " because:" << ec.message() << endl;
+					return false;
+				}
+
+				connection->hdl = con->get_handle();
+				con->set_open_handler([this, connection](websocketpp::connection_hdl hdl){ on_open(connection, hdl); });
+				con->set_close_handler([this, connection](websocketpp::connection_hdl hdl){ on_close(connection, hdl); });
+				con->set_fail_handler([this, connection](websocketpp::connection_hdl hdl){ on_close(connection, hdl); });
+				con->set_message_handler([this, connection](websocketpp::connection_hdl hdl, client::message_ptr msg){ on_message(connection, hdl, msg); });
+				_client.connect(con);
+			}
+		}
+
+		_client.start_perpetual();
+		vector<thread> threads;
+		for(int i = 0; i < options.threads; ++i)
+			threads.push_back(thread([this]{ _client.run(); }));
+
+		// every client connected before the clock starts
+		for(int waited = 0; n_open < (int)connections.size() && waited < 100; ++waited)
+			this_thread::sleep_for(chrono::milliseconds(100));
+		cout << n_open << " of " << connections.size() << " clients connected" << endl;
+
+		start_ns = Metrics::now_ns();
+		stop_ns = start_ns + options.seconds * 1000000000LL;
+		for(auto it = types.begin(); it != types.end(); ++it)
+			(*it)->next_due_ns = start_ns;
+		_client.get_io_service().post([this]{ tick(websocketpp::lib::error_code()); });
+
+		for(int second = 1; second <= options.seconds; ++second)
+		{
+			this_thread::sleep_for(chrono::seconds(1));
+			if(second % 5 == 0)
+				cout << second << "s: " << n_open << " clients open, " << outstanding() << " requests outstanding" << endl;
+		}
+
+		for(int waited = 0; outstanding() > 0 && waited < options.drain_seconds * 10; ++waited)
+			this_thread::sleep_for(chrono::milliseconds(100));
+
+		report((Metrics::now_ns() - start_ns) / 1e9);
+
+		for(auto it = connections.begin(); it != connections.end(); ++it)
+		{
+			websocketpp::lib::error_code ec;
+			_client.close((*it)->hdl, websocketpp::close::status::normal, "done", ec);
+		}
+		_client.stop_perpetual();
+		for(auto it = threads.begin(); it != threads.end(); ++it)
+			it->join();
+
+		return true;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if(!parse_options(argc, argv, options))
+	{
+		cout << "usage: ./load_generator [host=127.0.0.1] [seconds=30] [drain_seconds=5] [clients=10] [threads=2]" << endl;
+		cout << "       [chart=20] [deals=10] [booking=1] [basket=0] [risk=0.5] (requests per second, 0 for none)" << endl;
+		cout << "       [basket_size=10000] (trades per basket)" << endl;
+		cout << "       [tickers=AAPL,MSFT,GOOG] [books=1] [customer_books=2] [report=VarianceCovarianceVAR] [binary=0]" << endl;
+		return 1;
+	}
+
+	LoadGenerator generator(options);
+	return generator.run() ? 0 : 1;
+}
@@ -3,30 +3,79 @@
 #include "init_end_point.hpp"
 #include "booking_end_point.hpp"
 #include "risk_report_end_point.hpp"
+#include "server_runtime.hpp"
+#include "task_scheduler.hpp"
+#include "subscription_hub.hpp"
+#include "init_snapshot.hpp"
+#include "trade_journal.hpp"
+#include "position_keeper.hpp"
+#include "pre_trade_gate.hpp"
 #include "var.hpp"
 #include "book.hpp"
+#include "quote_poller.hpp"
+#include "configuration.hpp"
 #include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <chrono>
 
 using namespace std;
 //using namespace mlpack;
 
+vector<string> get_tickers()
+{
+	vector<string> tickers;
+
+	MysqlManager *mysql_manager = MysqlManager::get_instance();
+	sql::ResultSet* res = mysql_manager->executeQuery("select Symbol from Tickers");
+
+	while(res->next())
+	{
+		tickers.push_back(res->getString("Symbol"));
+	}
+
+	return tickers;
+}
+
 int main()
 {
-	cout << "connect to init_server" << endl;
-	InitEndPoint init_end_point(9002);
-	init_end_point.run();
-
-	cout << "connect to booking_server" << endl;
-	BookingEndPoint booking_end_point(9003);
-	booking_end_point.run();
-
-	cout << "connect to risk_report_server" << endl;
-        RiskReportEndPoint risk_report_end_point(9004);
-        risk_report_end_point.run();
-	
-	while(true){};
+	cout << "start latest quote poller" << endl;
+	Configuration *config = Configuration::get_instance();
+	QuotePoller quote_poller(get_tickers(), chrono::seconds(config->quote_poll_seconds), config->quote_batch_size);
+	quote_poller.start();
+
+	TaskScheduler::init(config->worker_threads);
+	Metrics::get_instance(); // before the first request records anything
+
+	// new prices move the positions and risk of every book holding the tickers
+	QuoteCache::get_instance()->add_listener([](const vector<string> &tickers){
+		SubscriptionHub::get_instance()->invalidate_prefix("positions:", tickers);
+		SubscriptionHub::get_instance()->invalidate_prefix("risk:", tickers);
+		PreTradeGate::get_instance()->invalidate();
+	});
+
+	InitEndPoint init_end_point(9002, config->init_server_threads);
+	BookingEndPoint booking_end_point(9003, config->booking_server_threads);
+	RiskReportEndPoint risk_report_end_point(9004, config->risk_server_threads);
+
+	ServerRuntime runtime(config->server_threads);
+	runtime.add(init_end_point);
+	runtime.add(booking_end_point);
+	runtime.add(risk_report_end_point);
+	InitSnapshot::get_instance()->start(chrono::seconds(config->init_refresh_seconds));
+	if(!PositionKeeper::get_instance()->load()) // before the journal replays trades into it
+		cout << "price books off Deal without the position keeper" << endl;
+	else if(!PreTradeGate::get_instance()->load()) // with the keeper's positions, before the journal replays
+		cout << "book without pre-trade limits" << endl;
+	if(!config->journal_path.empty() && !TradeJournal::get_instance()->start(config->journal_path))
+		cout << "book without the trade journal" << endl;
+	runtime.run(); // until SIGINT/SIGTERM and every connection is drained
+
+	TradeJournal::get_instance()->stop(); // journaled trades are applied before the scheduler stops
+	InitSnapshot::get_instance()->stop();
+	TaskScheduler::get_instance()->stop();
+	quote_poller.stop();
 	cout << "finish" << endl;
 	return 0;
 }
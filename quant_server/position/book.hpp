@@ -2,6 +2,10 @@
 #define BOOK_H
 
 #include "mysql.hpp"
+#include "quote_cache.hpp"
+#include "position_keeper.hpp"
+#include "configuration.hpp"
+#include <chrono>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -53,7 +57,47 @@ public:
 		asset_economics = book.asset_economics;
 	}
 
+	// positions and last closes come from the position keeper when the server loaded it, else from the db
 	Book(string ID, bool trading_book=true)
+	{
+		PositionKeeper *keeper = PositionKeeper::get_instance();
+		if(keeper->is_loaded())
+		{
+			deals = keeper->snapshot(ID, trading_book).quantities;
+			shared_ptr<const unordered_map<string, double>> closes = keeper->last_closes();
+			for(auto it = deals.begin(); it != deals.end(); ++it)
+			{
+				auto close = closes->find(it->first);
+				if(close != closes->end())
+					ticker_price[it->first] = close->second;
+			}
+		}
+		else
+			load(ID, trading_book);
+
+		// intraday prices beat yesterday's close when the quote poller is running
+		vector<string> book_tickers;
+		for(auto it = deals.begin(); it != deals.end(); ++it)
+			book_tickers.push_back(it->first);
+
+		chrono::seconds max_age(2 * Configuration::get_instance()->quote_poll_seconds);
+		unordered_map<string, double> latest_prices = QuoteCache::get_instance()->get_fresh(book_tickers, max_age);
+		for(auto it = latest_prices.begin(); it != latest_prices.end(); ++it)
+			ticker_price[it->first] = it->second;
+
+		// store asset quantity and price
+		for(auto it = deals.begin(); it != deals.end(); ++it)
+		{
+			AssetEconomics ae;
+			ae.quantity = it->second;
+			ae.price = ticker_price[it->first];
+			asset_economics[it->first] = ae;
+		}
+	}
+
+private:
+	// deals of the book and the close of their tickers on the last quote date
+	void load(string ID, bool trading_book)
 	{
 		MysqlManager *mysql_manager = MysqlManager::get_instance();
 
@@ -96,17 +140,10 @@ public:
 
                         ticker_price[ticker] = price;
                 }
-
-		// store asset quantity and price
-		for(auto it = deals.begin(); it != deals.end(); ++it)
-		{
-			AssetEconomics ae;
-			ae.quantity = it->second;
-			ae.price = ticker_price[it->first];
-			asset_economics[it->first] = ae;
-		}
 	}
 
+public:
+
 	double price(string date = "latest_date")
 	{
 		// book can price on any specific date
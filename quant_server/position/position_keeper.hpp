@@ -0,0 +1,233 @@
+#ifndef POSITION_KEEPER_HPP
+#define POSITION_KEEPER_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "task_scheduler.hpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+// the positions of one book at one moment, version counts the trades applied to it so far
+struct PositionSnapshot
+{
+	unordered_map<string, double> quantities; // ticker -> net quantity
+	long long version;
+
+	PositionSnapshot():version(0){}
+};
+
+// Net quantity per ticker of every trading book and customer book, read from Deal once at startup and moved
+// by each applied trade in place, so Book, the positions topic and the risk reports take a book's positions
+// without going to the db. A book has its own lock: a trade touches two books, a snapshot copies one.
+// The last close of every ticker is kept too, reloaded in the background every init_refresh_seconds.
+class PositionKeeper
+{
+private:
+	struct Positions
+	{
+		mutex mtx;
+		unordered_map<string, double> quantities;
+		long long version;
+
+		Positions():version(0){}
+	};
+
+	static PositionKeeper *instance;
+
+	mutex mtx;
+	bool loaded;
+	unordered_map<string, shared_ptr<Positions>> trading_books;
+	unordered_map<string, shared_ptr<Positions>> customer_books;
+	shared_ptr<const unordered_map<string, double>> closes;
+	chrono::steady_clock::time_point closes_loaded;
+	bool loading_closes;
+
+	PositionKeeper():loaded(false), loading_closes(false){}
+
+	static shared_ptr<Positions> find(unordered_map<string, shared_ptr<Positions>> &books, const string &book_id, bool create)
+	{
+		auto it = books.find(book_id);
+		if(it != books.end())
+			return it->second;
+		if(!create)
+			return shared_ptr<Positions>();
+
+		shared_ptr<Positions> positions(new Positions());
+		books[book_id] = positions;
+		return positions;
+	}
+
+	static void add(Positions &positions, const string &ticker, double quantity)
+	{
+		lock_guard<mutex> lock(positions.mtx);
+		positions.quantities[ticker] += quantity;
+		++positions.version;
+	}
+
+	static shared_ptr<const unordered_map<string, double>> load_closes()
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Symbol, Close from Quotes where Date=(select max(Date) from Quotes)"));
+
+		shared_ptr<unordered_map<string, double>> loaded_closes(new unordered_map<string, double>());
+		while(res->next())
+			(*loaded_closes)[res->getString("Symbol")] = res->getDouble("Close");
+
+		return loaded_closes;
+	}
+
+	void reload_closes()
+	{
+		shared_ptr<const unordered_map<string, double>> reloaded;
+		try{
+			reloaded = load_closes();
+		}catch(const std::exception &exc){
+			cout << "failed to reload the last closes because:" << exc.what() << endl;
+		}
+
+		lock_guard<mutex> lock(mtx);
+		if(reloaded)
+			closes = reloaded;
+		closes_loaded = chrono::steady_clock::now();
+		loading_closes = false;
+	}
+
+public:
+	static PositionKeeper* get_instance()
+	{
+		if(!instance)
+			instance = new PositionKeeper();
+
+		return instance;
+	}
+
+	// every deal of every book, once before the first trade is applied
+	bool load()
+	{
+		unordered_map<string, shared_ptr<Positions>> trading, customer;
+		shared_ptr<const unordered_map<string, double>> last_closes;
+		try{
+			MysqlManager *mysql_manager = MysqlManager::get_instance();
+			unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Book1_ID, Book2_ID, Ticker, Quantity from Deal"));
+			while(res->next())
+			{
+				string ticker = res->getString("Ticker");
+				double quantity = res->getDouble("Quantity");
+				find(trading, res->getString("Book1_ID"), true)->quantities[ticker] += quantity;
+				find(customer, res->getString("Book2_ID"), true)->quantities[ticker] += quantity;
+			}
+
+			last_closes = load_closes();
+		}catch(const std::exception &exc){
+			cout << "failed to load the positions because:" << exc.what() << endl;
+			return false;
+		}
+
+		lock_guard<mutex> lock(mtx);
+		trading_books.swap(trading);
+		customer_books.swap(customer);
+		closes = last_closes;
+		closes_loaded = chrono::steady_clock::now();
+		loaded = true;
+		return true;
+	}
+
+	// positions are served from here, otherwise the caller has to read Deal itself
+	bool is_loaded()
+	{
+		lock_guard<mutex> lock(mtx);
+		return loaded;
+	}
+
+	// a trade of quantity ticker between trading book book1_id and customer book book2_id
+	void apply(const string &book1_id, const string &book2_id, const string &ticker, double quantity)
+	{
+		shared_ptr<Positions> trading, customer;
+		{
+			lock_guard<mutex> lock(mtx);
+			if(!loaded)
+				return;
+
+			trading = find(trading_books, book1_id, true);
+			customer = find(customer_books, book2_id, true);
+		}
+
+		add(*trading, ticker, quantity);
+		add(*customer, ticker, quantity);
+	}
+
+	PositionSnapshot snapshot(const string &book_id, bool trading_book = true)
+	{
+		PositionSnapshot snap;
+		shared_ptr<Positions> positions;
+		{
+			lock_guard<mutex> lock(mtx);
+			positions = find(trading_book ? trading_books : customer_books, book_id, false);
+		}
+
+		if(positions)
+		{
+			lock_guard<mutex> lock(positions->mtx);
+			snap.quantities = positions->quantities;
+			snap.version = positions->version;
+		}
+
+		return snap;
+	}
+
+	vector<string> trading_book_ids()
+	{
+		lock_guard<mutex> lock(mtx);
+		vector<string> ids;
+		for(auto it = trading_books.begin(); it != trading_books.end(); ++it)
+			ids.push_back(it->first);
+
+		return ids;
+	}
+
+	// whether the trading book has a position in any of tickers
+	bool holds_any(const string &book_id, const set<string> &tickers)
+	{
+		shared_ptr<Positions> positions;
+		{
+			lock_guard<mutex> lock(mtx);
+			positions = find(trading_books, book_id, false);
+		}
+
+		if(!positions)
+			return false;
+
+		lock_guard<mutex> lock(positions->mtx);
+		for(auto it = tickers.begin(); it != tickers.end(); ++it)
+			if(positions->quantities.count(*it))
+				return true;
+
+		return false;
+	}
+
+	// the last close of every ticker, a reload is queued once it is older than init_refresh_seconds
+	shared_ptr<const unordered_map<string, double>> last_closes()
+	{
+		lock_guard<mutex> lock(mtx);
+		int refresh_seconds = Configuration::get_instance()->init_refresh_seconds;
+		if(loaded && !loading_closes && refresh_seconds > 0 && chrono::steady_clock::now() - closes_loaded > chrono::seconds(refresh_seconds))
+		{
+			loading_closes = true;
+			TaskScheduler::get_instance()->post(BATCH, [this]{ reload_closes(); });
+		}
+
+		return closes;
+	}
+};
+
+PositionKeeper *PositionKeeper::instance = NULL;
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef QUOTE_STORE_HPP
+#define QUOTE_STORE_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "quote_validator.hpp"
+#include "date_util.hpp"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+// Daily bars of the most recently charted symbols, in date order so the bars after a day are found with a
+// binary search. A symbol is reloaded when its version (number of days, last date, prices) moved, checked at
+// most every chart_revalidate_seconds; the least recently used go once there are quote_store_symbols.
+class QuoteStore
+{
+private:
+	struct Entry
+	{
+		shared_ptr<const QuoteBatch> quotes;
+		string version;
+		chrono::steady_clock::time_point checked;
+		list<string>::iterator recency;
+	};
+
+	static QuoteStore *instance;
+
+	mutex mtx;
+	unordered_map<string, Entry> entries;
+	list<string> recency; // most recently used first
+
+	static shared_ptr<const QuoteBatch> load(const string &symbol)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Date, Open, High, Low, Close from Quotes where Symbol=? order by Date", {symbol}));
+
+		shared_ptr<QuoteBatch> quotes(new QuoteBatch());
+		quotes->symbol = symbol;
+		quotes->reserve(res->rowsCount());
+		while(res->next())
+			quotes->push_back(parse_day(res->getString("Date")), res->getDouble("Open"), res->getDouble("High"), res->getDouble("Low"), res->getDouble("Close"), 0, 0);
+		quotes->sort_by_day();
+
+		return quotes;
+	}
+
+public:
+	static QuoteStore* get_instance()
+	{
+		if(!instance)
+			instance = new QuoteStore();
+
+		return instance;
+	}
+
+	// what the bars of symbol in the db look like now, without reading them: the number of days, the last
+	// one and a checksum of the prices, so a bar corrected in place by a rerun of the ingest counts too
+	static string version_of(const string &symbol)
+	{
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select count(*) as Days, max(Date) as Last, "
+			"coalesce(sum(crc32(concat_ws(',', Date, Open, High, Low, Close))), 0) as Prices from Quotes where Symbol=?", {symbol}));
+		if(!res->next())
+			return "";
+
+		return res->getString("Days") + ":" + res->getString("Last") + ":" + res->getString("Prices");
+	}
+
+	// index of the first bar after day, size() when there is none
+	static size_t first_after(const QuoteBatch &quotes, int day)
+	{
+		return upper_bound(quotes.day.begin(), quotes.day.end(), day) - quotes.day.begin();
+	}
+
+	shared_ptr<const QuoteBatch> get(const string &symbol)
+	{
+		chrono::seconds max_age(Configuration::get_instance()->chart_revalidate_seconds);
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = entries.find(symbol);
+			if(it != entries.end())
+			{
+				recency.splice(recency.begin(), recency, it->second.recency);
+				if(chrono::steady_clock::now() - it->second.checked < max_age)
+					return it->second.quotes;
+			}
+		}
+
+		string version = version_of(symbol);
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = entries.find(symbol);
+			if(it != entries.end() && it->second.version == version)
+			{
+				it->second.checked = chrono::steady_clock::now();
+				return it->second.quotes;
+			}
+		}
+
+		shared_ptr<const QuoteBatch> quotes = load(symbol);
+
+		lock_guard<mutex> lock(mtx);
+		auto it = entries.find(symbol);
+		if(it == entries.end())
+		{
+			recency.push_front(symbol);
+			it = entries.insert(make_pair(symbol, Entry())).first;
+			it->second.recency = recency.begin();
+		}
+		it->second.quotes = quotes;
+		it->second.version = version;
+		it->second.checked = chrono::steady_clock::now();
+
+		while(entries.size() > (size_t)max(1, Configuration::get_instance()->quote_store_symbols))
+		{
+			entries.erase(recency.back());
+			recency.pop_back();
+		}
+
+		return quotes;
+	}
+};
+
+QuoteStore *QuoteStore::instance = NULL;
+
+#endif
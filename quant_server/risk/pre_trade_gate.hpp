@@ -0,0 +1,637 @@
+#ifndef PRE_TRADE_GATE_HPP
+#define PRE_TRADE_GATE_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "metrics.hpp"
+#include "quote_cache.hpp"
+#include "position_keeper.hpp"
+#include "task_scheduler.hpp"
+#include "trade_journal.hpp"
+#include "date_util.hpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// limits of one Trading_Book node over its whole subtree, negative for none
+struct TradingLimits
+{
+	double gross_notional; // sum of |quantity| * price
+	double net_notional; // |sum of quantity * price|
+	double ticker_position; // |quantity| of any one ticker
+	double var; // one day parametric VaR at 99%
+
+	TradingLimits():gross_notional(-1), net_notional(-1), ticker_position(-1), var(-1){}
+
+	bool priced() const { return gross_notional >= 0 || net_notional >= 0 || var >= 0; }
+};
+
+// Pre-trade limit checks against Trading_Book_Limit, in memory so a check costs microseconds rather than
+// a round trip. A node's limits cover the trading book and every book under it in the Trading_Book tree,
+// a trade is checked against the limits of its book and of each node above it.
+//
+// Every node with limits keeps its positions with the dollar exposure w of each ticker, the gross and net
+// notional, g = Cov * w and the variance w' * Cov * w, so the VaR after a trade of dw in ticker t is
+// z * sqrt(variance + 2 * dw * g[t] + dw^2 * Cov[t][t]) without touching the other tickers. Cov is of the
+// daily returns over limit_history_days; a ticker without enough history gets limit_default_volatility and
+// full correlation with the rest, which can only overstate the VaR.
+//
+// A trade that passes is counted at once (reserve), before it is journaled, so trades racing each other
+// can not both slip under a limit; a trade that is then not booked is released. Trades making a measure
+// smaller always pass, a book over a limit can trade back under it.
+//
+// Working the exposures out again costs O(nodes * tickers^2), so it is never done under the lock: a new
+// Model is built in the background, at new prices on quote updates and with the tree, the limits and the
+// covariance read again every init_refresh_seconds, and swapped in with the trades counted meanwhile.
+class PreTradeGate
+{
+private:
+	struct Node
+	{
+		string book_id;
+		TradingLimits limits;
+		vector<double> quantity; // by ticker index, over the subtree
+		vector<double> cov_exposure; // g = Cov * w
+		double gross;
+		double net;
+		double variance;
+
+		Node():gross(0), net(0), variance(0){}
+	};
+
+	// what a trade is checked with
+	struct Model
+	{
+		unordered_map<string, string> parents; // trading book -> parent, Trading_Book
+		unordered_map<string, shared_ptr<Node>> nodes; // trading books with limits
+		unordered_map<string, vector<Node*>> guards; // trading book -> the nodes its trades are checked against
+		unordered_map<string, int> ticker_index;
+		vector<string> tickers;
+		vector<double> prices; // 0 for unknown
+		vector<double> volatility; // daily
+		shared_ptr<const vector<vector<double>>> history_cov; // of the first tickers, estimated from Quotes
+
+		Model():history_cov(new vector<vector<double>>()){}
+
+		// tickers past the estimated ones are fully correlated with everything
+		double cov(size_t i, size_t j) const
+		{
+			size_t n = history_cov->size();
+			return i < n && j < n ? (*history_cov)[i][j] : volatility[i] * volatility[j];
+		}
+	};
+
+	// a trade counted while a new model was being built
+	struct Change
+	{
+		string book_id;
+		string ticker;
+		double quantity;
+	};
+
+	static PreTradeGate *instance;
+	static constexpr double z_score = 2.33; // 99%, as VarianceCovarianceVAR
+
+	mutex mtx;
+	bool loaded;
+	bool rebuilding; // a rebuild is queued or running
+	bool rebuild_again; // prices moved since it took its copy
+	bool reload_again; // the next one reads the db
+	chrono::steady_clock::time_point reloaded;
+	shared_ptr<Model> model;
+	unordered_map<string, unordered_map<string, double>> book_positions; // trading book -> ticker -> quantity, with trades in flight
+	vector<Change> changes; // since the running rebuild took its copy
+
+	Histogram *check_latency;
+	atomic<long long> *passed;
+	atomic<long long> *rejected;
+
+	PreTradeGate():loaded(false), rebuilding(false), rebuild_again(false), reload_again(false), model(new Model())
+	{
+		Metrics *metrics = Metrics::get_instance();
+		check_latency = metrics->histogram("pretrade_check_us");
+		passed = metrics->counter("pretrade_total", "result=\"pass\"");
+		rejected = metrics->counter("pretrade_total", "result=\"reject\"");
+	}
+
+	static double price_of(const string &ticker, const unordered_map<string, double> &closes)
+	{
+		CachedQuote quote;
+		if(QuoteCache::get_instance()->get(ticker, quote) && quote.price > 0)
+			return quote.price;
+
+		auto close = closes.find(ticker);
+		return close == closes.end() ? 0 : close->second;
+	}
+
+	static double default_volatility()
+	{
+		return Configuration::get_instance()->limit_default_volatility;
+	}
+
+	static shared_ptr<const unordered_map<string, double>> last_closes()
+	{
+		shared_ptr<const unordered_map<string, double>> closes = PositionKeeper::get_instance()->last_closes();
+		return closes ? closes : shared_ptr<const unordered_map<string, double>>(new unordered_map<string, double>());
+	}
+
+	// daily return covariance of symbols over the last limit_history_days quote dates, closes carried over
+	// days a symbol has none. Symbols with less than 20 closes in the window get the default volatility and
+	// full correlation.
+	static vector<vector<double>> load_covariance(const vector<string> &symbols)
+	{
+		size_t n = symbols.size();
+		vector<vector<double>> covariance(n, vector<double>(n, 0));
+		if(n == 0)
+			return covariance;
+
+		int history_days = max(2, Configuration::get_instance()->limit_history_days);
+		unordered_map<string, int> index;
+		string symbol_list;
+		for(size_t i = 0; i < n; ++i)
+		{
+			index[symbols[i]] = i;
+			symbol_list += string(i ? "," : "") + "'" + symbols[i] + "'";
+		}
+
+		vector<map<int, double>> closes(n);
+		set<int> days;
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Symbol, Date, Close from Quotes where Symbol in (" + symbol_list +
+				") and Date > date_sub((select max(Date) from Quotes), interval " + to_string(history_days * 2) + " day)"));
+		while(res->next())
+		{
+			auto it = index.find(res->getString("Symbol"));
+			int day = parse_day(res->getString("Date"));
+			if(it == index.end() || day < 0)
+				continue;
+
+			closes[it->second][day] = res->getDouble("Close");
+			days.insert(day);
+		}
+
+		vector<int> calendar(days.begin(), days.end());
+		if(calendar.size() > (size_t)history_days + 1)
+			calendar.erase(calendar.begin(), calendar.end() - history_days - 1);
+
+		size_t n_returns = calendar.size() > 1 ? calendar.size() - 1 : 0;
+		vector<vector<double>> returns(n);
+		vector<double> volatility(n, default_volatility());
+		vector<bool> has_history(n, false);
+		for(size_t i = 0; i < n && n_returns > 1; ++i)
+		{
+			if(closes[i].size() < 20)
+				continue;
+
+			vector<double> aligned(calendar.size());
+			for(size_t d = 0; d < calendar.size(); ++d)
+			{
+				auto at = closes[i].upper_bound(calendar[d]);
+				aligned[d] = at == closes[i].begin() ? closes[i].begin()->second : prev(at)->second;
+			}
+
+			double mean = 0;
+			returns[i].resize(n_returns);
+			for(size_t d = 0; d < n_returns; ++d)
+			{
+				returns[i][d] = aligned[d] > 0 ? aligned[d + 1] / aligned[d] - 1 : 0;
+				mean += returns[i][d];
+			}
+			mean /= n_returns;
+			for(size_t d = 0; d < n_returns; ++d)
+				returns[i][d] -= mean;
+
+			has_history[i] = true;
+		}
+
+		for(size_t i = 0; i < n; ++i)
+		{
+			if(has_history[i])
+			{
+				double sum = 0;
+				for(size_t d = 0; d < n_returns; ++d)
+					sum += returns[i][d] * returns[i][d];
+				volatility[i] = sqrt(sum / (n_returns - 1));
+			}
+		}
+
+		for(size_t i = 0; i < n; ++i)
+		{
+			for(size_t j = 0; j <= i; ++j)
+			{
+				double c = volatility[i] * volatility[j];
+				if(has_history[i] && has_history[j])
+				{
+					double sum = 0;
+					for(size_t d = 0; d < n_returns; ++d)
+						sum += returns[i][d] * returns[j][d];
+					c = sum / (n_returns - 1);
+				}
+				covariance[i][j] = covariance[j][i] = c;
+			}
+		}
+
+		return covariance;
+	}
+
+	// index of ticker in m, a ticker seen for the first time is priced and has the default volatility. The
+	// nodes are not touched.
+	static int add_ticker(Model &m, const string &ticker, const unordered_map<string, double> &closes)
+	{
+		auto it = m.ticker_index.find(ticker);
+		if(it != m.ticker_index.end())
+			return it->second;
+
+		int t = m.tickers.size();
+		m.ticker_index[ticker] = t;
+		m.tickers.push_back(ticker);
+		m.prices.push_back(price_of(ticker, closes));
+		m.volatility.push_back(default_volatility());
+		return t;
+	}
+
+	// as add_ticker, with the nodes of m extended by the new ticker
+	static int index_of(Model &m, const string &ticker)
+	{
+		auto it = m.ticker_index.find(ticker);
+		if(it != m.ticker_index.end())
+			return it->second;
+
+		int t = add_ticker(m, ticker, *last_closes());
+		for(auto node = m.nodes.begin(); node != m.nodes.end(); ++node)
+		{
+			Node &n = *node->second;
+			double g = 0;
+			for(int j = 0; j < t; ++j)
+				g += m.cov(t, j) * n.quantity[j] * m.prices[j];
+			n.quantity.push_back(0);
+			n.cov_exposure.push_back(g);
+		}
+
+		return t;
+	}
+
+	// the nodes with limits on the way from book to the root
+	static const vector<Node*>& guards_of(Model &m, const string &book_id)
+	{
+		auto cached = m.guards.find(book_id);
+		if(cached != m.guards.end())
+			return cached->second;
+
+		vector<Node*> &path = m.guards[book_id];
+		string id = book_id;
+		for(int depth = 0; depth < 64 && !id.empty(); ++depth)
+		{
+			auto node = m.nodes.find(id);
+			if(node != m.nodes.end())
+				path.push_back(node->second.get());
+
+			auto parent = m.parents.find(id);
+			if(parent == m.parents.end() || parent->second == id)
+				break;
+			id = parent->second;
+		}
+
+		return path;
+	}
+
+	// the nodes of m for limits with their quantities from positions. Every ticker is indexed before any
+	// node is sized, so all of them have one entry per ticker.
+	static void build_nodes(Model &m, const unordered_map<string, TradingLimits> &limits,
+			const unordered_map<string, unordered_map<string, double>> &positions)
+	{
+		m.nodes.clear();
+		m.guards.clear();
+		for(auto it = limits.begin(); it != limits.end(); ++it)
+		{
+			shared_ptr<Node> node(new Node());
+			node->book_id = it->first;
+			node->limits = it->second;
+			m.nodes[it->first] = node;
+		}
+
+		shared_ptr<const unordered_map<string, double>> closes = last_closes();
+		for(auto it = positions.begin(); it != positions.end(); ++it)
+			if(!guards_of(m, it->first).empty())
+				for(auto position = it->second.begin(); position != it->second.end(); ++position)
+					add_ticker(m, position->first, *closes);
+
+		size_t n = m.tickers.size();
+		for(auto node = m.nodes.begin(); node != m.nodes.end(); ++node)
+			node->second->quantity.assign(n, 0);
+
+		for(auto it = positions.begin(); it != positions.end(); ++it)
+		{
+			const vector<Node*> &path = guards_of(m, it->first);
+			for(auto position = it->second.begin(); position != it->second.end(); ++position)
+				for(auto node = path.begin(); node != path.end(); ++node)
+					(*node)->quantity[m.ticker_index[position->first]] += position->second;
+		}
+	}
+
+	// notionals, g and variance of node from its quantities at the prices of m
+	static void measure(const Model &m, Node &node)
+	{
+		size_t n = m.tickers.size();
+		vector<double> exposure(n);
+		node.gross = node.net = node.variance = 0;
+		node.cov_exposure.assign(n, 0);
+		for(size_t i = 0; i < n; ++i)
+		{
+			exposure[i] = node.quantity[i] * m.prices[i];
+			node.gross += fabs(exposure[i]);
+			node.net += exposure[i];
+		}
+
+		if(node.limits.var < 0)
+			return;
+
+		for(size_t i = 0; i < n; ++i)
+		{
+			if(exposure[i] == 0)
+				continue;
+			for(size_t j = 0; j < n; ++j)
+				node.cov_exposure[j] += m.cov(j, i) * exposure[i];
+		}
+		for(size_t i = 0; i < n; ++i)
+			node.variance += exposure[i] * node.cov_exposure[i];
+	}
+
+	// a new model off the lock: with reload the tree, the limits and the covariance read again, otherwise
+	// the current one at the current prices. The trades counted meanwhile go into it before it is swapped in.
+	void rebuild(bool reload)
+	{
+		shared_ptr<Model> next(new Model());
+		unordered_map<string, TradingLimits> limits;
+		unordered_map<string, unordered_map<string, double>> positions;
+		{
+			lock_guard<mutex> lock(mtx);
+			next->parents = model->parents;
+			next->ticker_index = model->ticker_index;
+			next->tickers = model->tickers;
+			next->volatility = model->volatility;
+			next->history_cov = model->history_cov;
+			for(auto it = model->nodes.begin(); it != model->nodes.end(); ++it)
+			{
+				limits[it->first] = it->second->limits;
+				if(reload)
+					continue;
+
+				shared_ptr<Node> node(new Node());
+				node->book_id = it->first;
+				node->limits = it->second->limits;
+				node->quantity = it->second->quantity;
+				next->nodes[it->first] = node;
+			}
+			if(reload)
+				positions = book_positions;
+			changes.clear();
+		}
+
+		shared_ptr<const unordered_map<string, double>> closes = last_closes();
+		for(auto it = next->tickers.begin(); it != next->tickers.end(); ++it)
+			next->prices.push_back(price_of(*it, *closes));
+
+		if(reload)
+		{
+			try{
+				unordered_map<string, string> tree;
+				unordered_map<string, TradingLimits> read;
+				MysqlManager *mysql_manager = MysqlManager::get_instance();
+				unique_ptr<sql::ResultSet> books(mysql_manager->executeQuery("select ID, ParentID from Trading_Book"));
+				while(books->next())
+					tree[books->getString("ID")] = books->isNull("ParentID") ? "" : books->getString("ParentID");
+
+				unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select * from Trading_Book_Limit"));
+				while(res->next())
+				{
+					TradingLimits &l = read[res->getString("Book_ID")];
+					l.gross_notional = res->isNull("Gross_Notional") ? -1 : res->getDouble("Gross_Notional");
+					l.net_notional = res->isNull("Net_Notional") ? -1 : res->getDouble("Net_Notional");
+					l.ticker_position = res->isNull("Ticker_Position") ? -1 : res->getDouble("Ticker_Position");
+					l.var = res->isNull("VaR") ? -1 : res->getDouble("VaR");
+				}
+
+				next->parents.swap(tree);
+				limits.swap(read);
+			}catch(const std::exception &exc){
+				cout << "failed to reload the pre-trade limits because:" << exc.what() << endl;
+			}
+
+			build_nodes(*next, limits, positions);
+
+			try{
+				shared_ptr<const vector<vector<double>>> covariance(new vector<vector<double>>(load_covariance(next->tickers)));
+				next->history_cov = covariance;
+				for(size_t i = 0; i < covariance->size(); ++i)
+					next->volatility[i] = sqrt((*covariance)[i][i]);
+			}catch(const std::exception &exc){
+				cout << "failed to reload the covariance of the pre-trade VaR because:" << exc.what() << endl;
+			}
+		}
+
+		for(auto it = next->nodes.begin(); it != next->nodes.end(); ++it)
+			measure(*next, *it->second);
+
+		lock_guard<mutex> lock(mtx);
+		for(auto it = changes.begin(); it != changes.end(); ++it)
+			add(*next, it->book_id, it->ticker, it->quantity);
+		changes.clear();
+		model = next;
+		rebuilding = false;
+		if(rebuild_again)
+			queue_rebuild(false);
+	}
+
+	// under mtx. Rebuilds coalesce: one runs at a time, whatever is asked for meanwhile runs once after it.
+	void queue_rebuild(bool reload)
+	{
+		reload_again = reload_again || reload;
+		if(rebuilding)
+		{
+			rebuild_again = true;
+			return;
+		}
+
+		bool reading = reload_again;
+		if(reading)
+			reloaded = chrono::steady_clock::now();
+		rebuilding = true;
+		rebuild_again = reload_again = false;
+		TaskScheduler::get_instance()->post(BATCH, [this, reading]{ rebuild(reading); });
+	}
+
+	// what keeps dq more of ticker t at price p in node from passing, "" if nothing
+	static string violation(const Model &m, const Node &node, int t, double dq, double p)
+	{
+		const TradingLimits &l = node.limits;
+		double q = node.quantity[t], q2 = q + dq;
+		if(l.ticker_position >= 0 && fabs(q2) > l.ticker_position && fabs(q2) > fabs(q))
+			return m.tickers[t] + " position " + to_string((long long)q2) + " over " + to_string((long long)l.ticker_position) + " in book " + node.book_id;
+
+		if(!l.priced())
+			return "";
+		if(p <= 0)
+			return "no price for " + m.tickers[t] + " to check the limits of book " + node.book_id;
+
+		double gross = node.gross + (fabs(q2) - fabs(q)) * p;
+		if(l.gross_notional >= 0 && gross > l.gross_notional && gross > node.gross)
+			return "gross notional " + to_string((long long)gross) + " over " + to_string((long long)l.gross_notional) + " in book " + node.book_id;
+
+		double net = node.net + dq * p;
+		if(l.net_notional >= 0 && fabs(net) > l.net_notional && fabs(net) > fabs(node.net))
+			return "net notional " + to_string((long long)net) + " over " + to_string((long long)l.net_notional) + " in book " + node.book_id;
+
+		if(l.var >= 0)
+		{
+			double dw = dq * p;
+			double var = z_score * sqrt(max(0.0, node.variance + 2 * dw * node.cov_exposure[t] + dw * dw * m.cov(t, t)));
+			if(var > l.var && var > z_score * sqrt(max(0.0, node.variance)))
+				return "VaR " + to_string((long long)var) + " over " + to_string((long long)l.var) + " in book " + node.book_id;
+		}
+
+		return "";
+	}
+
+	// dq more of ticker in the nodes of m above book
+	static void add(Model &m, const string &book_id, const string &ticker, double dq)
+	{
+		const vector<Node*> &path = guards_of(m, book_id);
+		if(path.empty())
+			return;
+
+		int t = index_of(m, ticker);
+		double p = m.prices[t], dw = dq * p;
+		for(auto it = path.begin(); it != path.end(); ++it)
+		{
+			Node &node = **it;
+			double q = node.quantity[t];
+			node.quantity[t] = q + dq;
+			node.gross += (fabs(q + dq) - fabs(q)) * p;
+			node.net += dw;
+			if(node.limits.var < 0 || dw == 0)
+				continue;
+
+			node.variance += 2 * dw * node.cov_exposure[t] + dw * dw * m.cov(t, t);
+			for(size_t i = 0; i < node.cov_exposure.size(); ++i)
+				node.cov_exposure[i] += m.cov(i, t) * dw;
+		}
+	}
+
+	// under mtx
+	void count(const Trade &trade, double dq)
+	{
+		book_positions[trade.book1_id][trade.ticker] += dq;
+		add(*model, trade.book1_id, trade.ticker, dq);
+		if(rebuilding)
+			changes.push_back(Change{trade.book1_id, trade.ticker, dq});
+	}
+
+public:
+	static PreTradeGate* get_instance()
+	{
+		if(!instance)
+			instance = new PreTradeGate();
+
+		return instance;
+	}
+
+	// the books' positions from the position keeper, then limits, prices and covariance. Before the trade
+	// journal replays anything, the replayed trades are added with reserve_unchecked.
+	bool load()
+	{
+		PositionKeeper *keeper = PositionKeeper::get_instance();
+		if(!keeper->is_loaded())
+			return false;
+
+		vector<string> books = keeper->trading_book_ids();
+		{
+			lock_guard<mutex> lock(mtx);
+			for(auto it = books.begin(); it != books.end(); ++it)
+			{
+				PositionSnapshot snapshot = keeper->snapshot(*it);
+				book_positions[*it].insert(snapshot.quantities.begin(), snapshot.quantities.end());
+			}
+			rebuilding = true;
+			reloaded = chrono::steady_clock::now();
+		}
+
+		rebuild(true);
+
+		lock_guard<mutex> lock(mtx);
+		loaded = true;
+		return true;
+	}
+
+	// new quotes, the exposures are worked out again at the new prices soon
+	void invalidate()
+	{
+		lock_guard<mutex> lock(mtx);
+		if(loaded)
+			queue_rebuild(false);
+	}
+
+	// check trade against the limits of its book and the nodes above and count it if it passes. What is
+	// over which limit if it does not, "" if it passed.
+	string reserve(const Trade &trade)
+	{
+		long long start = Metrics::now_ns();
+		string error;
+		{
+			lock_guard<mutex> lock(mtx);
+			if(!loaded)
+				return "";
+
+			int refresh_seconds = Configuration::get_instance()->init_refresh_seconds;
+			if(refresh_seconds > 0 && !reload_again && chrono::steady_clock::now() - reloaded > chrono::seconds(refresh_seconds))
+				queue_rebuild(true);
+
+			Model &m = *model;
+			const vector<Node*> &path = guards_of(m, trade.book1_id);
+			if(!path.empty())
+			{
+				int t = index_of(m, trade.ticker);
+				for(auto it = path.begin(); it != path.end() && error.empty(); ++it)
+					error = violation(m, **it, t, trade.quantity, m.prices[t]);
+			}
+
+			if(error.empty())
+				count(trade, trade.quantity);
+		}
+
+		check_latency->record(Metrics::now_ns() - start);
+		(error.empty() ? passed : rejected)->fetch_add(1, memory_order_relaxed);
+		return error;
+	}
+
+	// count trade without checking it, it was booked before (a journal replay)
+	void reserve_unchecked(const Trade &trade)
+	{
+		lock_guard<mutex> lock(mtx);
+		if(loaded)
+			count(trade, trade.quantity);
+	}
+
+	// a reserved trade was not booked after all, or the trade journal had to skip it
+	void release(const Trade &trade)
+	{
+		lock_guard<mutex> lock(mtx);
+		if(loaded)
+			count(trade, -trade.quantity);
+	}
+};
+
+PreTradeGate *PreTradeGate::instance = NULL;
+constexpr double PreTradeGate::z_score;
+
+#endif
@@ -7,8 +7,12 @@
 #include <sstream>
 #include <unordered_map>
 #include <vector>
+#include <set>
+#include <memory>
 #include "risk_report.hpp"
 #include "book.hpp"
+#include "position_keeper.hpp"
+#include "json_writer.hpp"
 
 using namespace std;
 
@@ -24,49 +28,127 @@ private:
 		else
 			return NULL;
 	}
+
+	// quote updates cover every ticker, skip rerunning reports of books they do not touch
+	bool holds_any(string book_id, const set<string> &tickers)
+	{
+		PositionKeeper *keeper = PositionKeeper::get_instance();
+		if(keeper->is_loaded())
+			return keeper->holds_any(book_id, tickers);
+
+		string query = "select 1 from Deal where Book1_ID = ? and Ticker in (";
+		vector<string> params(1, book_id);
+		for(auto it = tickers.begin(); it != tickers.end(); ++it)
+			query += it == tickers.begin() ? "?" : ",?";
+		query += ") limit 1";
+		params.insert(params.end(), tickers.begin(), tickers.end());
+
+		MysqlManager *mysql_manager = MysqlManager::get_instance();
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery(query, params));
+		return res->next();
+	}
+
+	// the risk values as one object, or error_msg. A pushed update names its report and book:
+	// {"risk_update":{"report":...,"book_id":...,"values":{...}}}
+	string get_risk_report_as_json(string report_name, string book_id, bool update)
+	{
+		unique_ptr<RiskReport> risk_report(create_risk_report_instance(report_name, book_id));
+		unordered_map<string, double> risk_vals;
+		if(risk_report)
+			risk_vals = risk_report->get_risk_values();
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		if(update)
+		{
+			writer.key("risk_update").begin_object();
+			writer.key("report").value(report_name);
+			writer.key("book_id").value(book_id);
+			writer.key("values").begin_object();
+		}
+
+		if(risk_report)
+		{
+			for(auto it = risk_vals.begin(); it != risk_vals.end(); ++it)
+				writer.key(it->first).value(it->second);
+		}
+		else
+		{
+			writer.key("error_msg").value(report_name + " for " + book_id + " is not available");
+		}
+
+		if(update)
+			writer.end_object().end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
 public:
-        RiskReportEndPoint(int port):EndPoint(port)
+        RiskReportEndPoint(int port, int n_threads = 0):EndPoint(port, n_threads)
 	{
 		report_list.push_back("VarianceCovarianceVAR");
+
+		// risk:<book id>:<report>, rerun when the book trades or its prices move
+		SubscriptionHub::get_instance()->set_refresher("risk", [this](const string &topic, const DirtyTickers &changed){
+			size_t book_start = topic.find(':') + 1;
+			size_t report_start = topic.find(':', book_start) + 1;
+			string book_id = topic.substr(book_start, report_start - book_start - 1);
+			if(!changed.all && !holds_any(book_id, changed.tickers))
+				return string();
+
+			return get_risk_report_as_json(topic.substr(report_start), book_id, true);
+		}, BATCH);
 	}
 
-        void on_open(server *s, websocketpp::connection_hdl hdl)
+        void on_open(server*, websocketpp::connection_hdl hdl)
 	{
-		string report_list_as_json = "{\"risk_reports\":[";
-                for(auto it = report_list.begin(); it != report_list.end(); ++it)
-                        report_list_as_json += "\"" + *it + "\",";
-                
-		report_list_as_json.pop_back(); // get ride of the last comma 
-                report_list_as_json += "]}";
-
-		s->send(hdl, report_list_as_json, websocketpp::frame::opcode::text);
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("risk_reports").begin_array();
+		for(auto it = report_list.begin(); it != report_list.end(); ++it)
+			writer.value(*it);
+		writer.end_array();
+		writer.end_object();
+
+		send(hdl, writer.str(), websocketpp::frame::opcode::text);
 	}
 
-        void on_message(server *s, websocketpp::connection_hdl hdl, server::message_ptr msg)
+        void on_message(server *s, websocketpp::connection_hdl hdl, const Request &request)
         {
-		stringstream ss(msg->get_payload());
+		stringstream ss(request.payload);
                 string report_name, book_id;
 		ss >> report_name >> book_id;
 
-		unique_ptr<RiskReport> risk_report(create_risk_report_instance(report_name, book_id));
-
-		string report_result = "{";
-		if(risk_report)
+		bool subscribing = report_name=="subscribe_risk";
+		if(subscribing)
 		{
-		        unordered_map<string, double> risk_vals = risk_report->get_risk_values();
-        		for(auto it = risk_vals.begin(); it != risk_vals.end(); ++it)
-                		report_result += "\"" + it->first + "\":\"" + to_string(it->second) + "\",";
+			report_name = book_id; // subscribe_risk <report> <book id>
+			ss >> book_id;
+		}
 
-			report_result.pop_back();
+		// the book id ends up in the queries of the book and of holds_any
+		if(!is_book_id(book_id))
+		{
+			JsonWriter &writer = JsonWriter::thread_writer();
+			writer.begin_object().key("error_msg").value("bad book id: " + request.payload).end_object();
+			reply(hdl, request, writer.str(), websocketpp::frame::opcode::text);
+			return;
 		}
-		else
+
+		// run now and again whenever the book trades or its prices move
+		if(subscribing)
 		{
-			report_result += "\"error_msg\":\"" + report_name + " for " + book_id + " is not available\"";
+			string topic = "risk:" + book_id + ":" + report_name;
+			subscribe(topic, hdl);
+			acknowledge(hdl, request, "subscribed", topic);
+			SubscriptionHub::get_instance()->invalidate(topic);
+			return;
 		}
-	
-		report_result += "}";
 
-                s->send(hdl, report_result, msg->get_opcode());
+		// reports load a book and a year of quotes, they queue behind interactive requests
+		reply_async(s, hdl, request, request.opcode, BATCH, [this, report_name, book_id]{
+			return get_risk_report_as_json(report_name, book_id, false);
+		});
         }
 
 };
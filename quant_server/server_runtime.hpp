@@ -0,0 +1,70 @@
+#ifndef SERVER_RUNTIME_HPP
+#define SERVER_RUNTIME_HPP
+
+#include "end_point.hpp"
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <csignal>
+#include <string>
+
+using namespace std;
+
+// Hosts the end points on one io_service run by a pool of threads,
+// end points asking for dedicated threads get their own io_service and pool instead (see EndPoint::get_io_service).
+// run() blocks the caller until SIGINT or SIGTERM, then stops accepting, closes the open connections
+// and returns once the in-flight work has drained.
+class ServerRuntime
+{
+private:
+	websocketpp::lib::asio::io_service io_service;
+	websocketpp::lib::asio::signal_set signals;
+	vector<EndPoint*> end_points;
+	size_t n_threads;
+
+	void on_signal(const websocketpp::lib::asio::error_code &ec, int signal_number)
+	{
+		if(ec)
+			return;
+
+		cout << "signal " << signal_number << " received, draining " << end_points.size() << " end points" << endl;
+		for(auto it = end_points.begin(); it != end_points.end(); ++it)
+			(*it)->drain();
+	}
+
+public:
+	// n_threads = 0 uses one thread per core
+	ServerRuntime(size_t n_threads = 0):signals(io_service, SIGINT, SIGTERM)
+	{
+		this->n_threads = n_threads > 0 ? n_threads : max(1u, thread::hardware_concurrency());
+	}
+
+	void add(EndPoint &end_point)
+	{
+		end_points.push_back(&end_point);
+	}
+
+	void run()
+	{
+		vector<thread> threads;
+		for(auto it = end_points.begin(); it != end_points.end(); ++it)
+		{
+			websocketpp::lib::asio::io_service *end_point_io_service = (*it)->get_io_service(&io_service);
+			(*it)->listen(end_point_io_service);
+			cout << "listen on " << (*it)->get_port() << " with " << ((*it)->get_threads() > 0 ? to_string((*it)->get_threads()) + " dedicated" : string("shared")) << " threads" << endl;
+
+			for(int i = 0; i < (*it)->get_threads(); ++i)
+				threads.push_back(thread([end_point_io_service]{ end_point_io_service->run(); }));
+		}
+
+		signals.async_wait(bind(&ServerRuntime::on_signal, this, ::_1, ::_2));
+
+		for(size_t i = 0; i < n_threads; ++i)
+			threads.push_back(thread([this]{ io_service.run(); }));
+
+		for(auto it = threads.begin(); it != threads.end(); ++it)
+			it->join();
+	}
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef SUBSCRIPTION_HUB_HPP
+#define SUBSCRIPTION_HUB_HPP
+
+#include <websocketpp/common/connection_hdl.hpp>
+#include "task_scheduler.hpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+struct Subscription
+{
+	const void *owner; // the end point the connection belongs to
+	websocketpp::connection_hdl hdl;
+	function<void(const string&)> send;
+};
+
+// tickers that changed since a topic was last refreshed, all means refresh everything
+struct DirtyTickers
+{
+	set<string> tickers;
+	bool all;
+
+	DirtyTickers():all(false){}
+};
+
+// Topics clients subscribe to, named kind:key..., e.g. deals:1, positions:1, risk:1:VarianceCovarianceVAR.
+// An update is serialized once by whoever publishes it and the same payload goes to every subscriber.
+// Kinds that are recomputed rather than published directly (deals, positions, risk) register a refresher;
+// invalidations of a topic pile up while its refresh is queued, so a burst of trades or quotes costs one refresh.
+class SubscriptionHub
+{
+private:
+	static SubscriptionHub *instance;
+	static const size_t fan_out_chunk = 64; // subscribers sent to by one task
+
+	mutex mtx;
+	unordered_map<string, vector<Subscription>> topics;
+	map<string, function<string(const string&, const DirtyTickers&)>> refreshers; // by kind, returns the update to publish or ""
+	map<string, TaskPriority> refresh_priority;
+	unordered_map<string, DirtyTickers> dirty; // topics with a refresh queued
+	set<string> refreshing; // topics whose refresher runs right now, the next refresh waits for it
+
+	// an update going out to a big audience in chunks
+	struct FanOut
+	{
+		shared_ptr<const string> payload;
+		shared_ptr<const vector<Subscription>> audience;
+	};
+	unordered_map<string, deque<FanOut>> fanning; // topics with a fan out running first, then the updates waiting for it
+
+	static bool same(const Subscription &s, const void *owner, websocketpp::connection_hdl hdl)
+	{
+		owner_less<websocketpp::connection_hdl> less;
+		return s.owner == owner && !less(s.hdl, hdl) && !less(hdl, s.hdl);
+	}
+
+	static string kind_of(const string &topic)
+	{
+		return topic.substr(0, topic.find(':'));
+	}
+
+	// under mtx
+	TaskPriority registered_priority(const string &topic)
+	{
+		auto p = refresh_priority.find(kind_of(topic));
+		return p != refresh_priority.end() ? p->second : BATCH;
+	}
+
+	// under mtx
+	void post_refresh(const string &topic)
+	{
+		TaskScheduler::get_instance()->post(registered_priority(topic), [this, topic]{ refresh(topic); });
+	}
+
+	// one refresh of a topic at a time, so what a later one read is never published before an earlier one
+	void refresh(string topic)
+	{
+		DirtyTickers changed;
+		function<string(const string&, const DirtyTickers&)> refresher;
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = dirty.find(topic);
+			if(it == dirty.end())
+				return;
+
+			changed = it->second;
+			dirty.erase(it);
+
+			auto r = refreshers.find(kind_of(topic));
+			if(r == refreshers.end() || topics.find(topic) == topics.end())
+				return;
+			refresher = r->second;
+			refreshing.insert(topic);
+		}
+
+		try{
+			string update = refresher(topic, changed);
+			if(!update.empty())
+				publish(topic, update);
+		}catch(const std::exception &exc){
+			cout << "failed to refresh " << topic << " because:" << exc.what() << endl;
+		}
+
+		lock_guard<mutex> lock(mtx);
+		refreshing.erase(topic);
+		if(dirty.count(topic))
+			post_refresh(topic);
+	}
+
+public:
+	static SubscriptionHub* get_instance()
+	{
+		if(!instance)
+			instance = new SubscriptionHub();
+
+		return instance;
+	}
+
+	void subscribe(const string &topic, const Subscription &subscription)
+	{
+		lock_guard<mutex> lock(mtx);
+		vector<Subscription> &subscribers = topics[topic];
+		for(auto it = subscribers.begin(); it != subscribers.end(); ++it)
+			if(same(*it, subscription.owner, subscription.hdl))
+				return;
+
+		subscribers.push_back(subscription);
+	}
+
+	void unsubscribe(const string &topic, const void *owner, websocketpp::connection_hdl hdl)
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = topics.find(topic);
+		if(it == topics.end())
+			return;
+
+		vector<Subscription> &subscribers = it->second;
+		for(size_t i = 0; i < subscribers.size(); ++i)
+		{
+			if(same(subscribers[i], owner, hdl))
+			{
+				subscribers[i] = subscribers.back();
+				subscribers.pop_back();
+				break;
+			}
+		}
+
+		if(subscribers.empty())
+			topics.erase(it);
+	}
+
+	// every topic of a connection that went away
+	void unsubscribe_all(const void *owner, websocketpp::connection_hdl hdl)
+	{
+		vector<string> subscribed;
+		{
+			lock_guard<mutex> lock(mtx);
+			for(auto it = topics.begin(); it != topics.end(); ++it)
+				for(auto s = it->second.begin(); s != it->second.end(); ++s)
+					if(same(*s, owner, hdl))
+						subscribed.push_back(it->first);
+		}
+
+		for(auto it = subscribed.begin(); it != subscribed.end(); ++it)
+			unsubscribe(*it, owner, hdl);
+	}
+
+	vector<string> topics_with_prefix(const string &prefix)
+	{
+		vector<string> matching;
+		lock_guard<mutex> lock(mtx);
+		for(auto it = topics.begin(); it != topics.end(); ++it)
+			if(it->first.compare(0, prefix.size(), prefix) == 0)
+				matching.push_back(it->first);
+
+		return matching;
+	}
+
+private:
+	// chunks of fan_out over the task scheduler, the last one to finish starts the next update of topic
+	void start_fan_out(const string &topic, const FanOut &fan_out)
+	{
+		size_t n = fan_out.audience->size();
+		shared_ptr<atomic<size_t>> remaining(new atomic<size_t>((n + fan_out_chunk - 1) / fan_out_chunk));
+		if(*remaining == 0)
+		{
+			fan_out_done(topic);
+			return;
+		}
+
+		for(size_t begin = 0; begin < n; begin += fan_out_chunk)
+		{
+			size_t end = min(begin + fan_out_chunk, n);
+			TaskScheduler::get_instance()->post(INTERACTIVE, [this, topic, fan_out, begin, end, remaining]{
+				for(size_t i = begin; i < end; ++i)
+				{
+					try{
+						(*fan_out.audience)[i].send(*fan_out.payload);
+					}catch(const std::exception &exc){
+						cout << "failed to send " << topic << " because:" << exc.what() << endl;
+					}
+				}
+
+				if(--*remaining == 0)
+					fan_out_done(topic);
+			});
+		}
+	}
+
+	void fan_out_done(const string &topic)
+	{
+		FanOut next;
+		{
+			lock_guard<mutex> lock(mtx);
+			deque<FanOut> &queue = fanning[topic];
+			queue.pop_front();
+			if(queue.empty())
+			{
+				fanning.erase(topic);
+				return;
+			}
+			next = queue.front();
+		}
+
+		start_fan_out(topic, next);
+	}
+
+public:
+	// send update to every subscriber of topic, big audiences are split over the task scheduler. Updates of a
+	// topic reach each subscriber in the order they were published: one that comes while a fan out of the
+	// topic is running waits for it. Returns how many subscribers it goes to.
+	size_t publish(const string &topic, const string &update)
+	{
+		vector<Subscription> subscribers;
+		FanOut fan_out;
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = topics.find(topic);
+			if(it == topics.end())
+				return 0;
+
+			if(it->second.size() <= fan_out_chunk && fanning.find(topic) == fanning.end())
+				subscribers = it->second;
+			else
+			{
+				fan_out.payload.reset(new string(update));
+				fan_out.audience.reset(new vector<Subscription>(it->second));
+				deque<FanOut> &queue = fanning[topic];
+				queue.push_back(fan_out);
+				if(queue.size() > 1)
+					return fan_out.audience->size();
+			}
+		}
+
+		if(!fan_out.audience)
+		{
+			for(auto it = subscribers.begin(); it != subscribers.end(); ++it)
+				it->send(update);
+			return subscribers.size();
+		}
+
+		start_fan_out(topic, fan_out);
+		return fan_out.audience->size();
+	}
+
+	void set_refresher(const string &kind, function<string(const string&, const DirtyTickers&)> refresher, TaskPriority priority = BATCH)
+	{
+		lock_guard<mutex> lock(mtx);
+		refreshers[kind] = refresher;
+		refresh_priority[kind] = priority;
+	}
+
+	// what work for topic runs at: the priority its refresher was registered with, BATCH if none was
+	TaskPriority priority_of(const string &topic)
+	{
+		lock_guard<mutex> lock(mtx);
+		return registered_priority(topic);
+	}
+
+	// the whole current state of topic from its refresher, "" if its kind has none.
+	// Sent to a subscriber that missed updates instead of replaying them.
+	string snapshot(const string &topic)
+	{
+		function<string(const string&, const DirtyTickers&)> refresher;
+		{
+			lock_guard<mutex> lock(mtx);
+			auto r = refreshers.find(kind_of(topic));
+			if(r == refreshers.end())
+				return "";
+			refresher = r->second;
+		}
+
+		DirtyTickers everything;
+		everything.all = true;
+		try{
+			return refresher(topic, everything);
+		}catch(const std::exception &exc){
+			cout << "failed to snapshot " << topic << " because:" << exc.what() << endl;
+		}
+
+		return "";
+	}
+
+	// queue a refresh of topic for the changed tickers (none for everything), merged into one already queued.
+	// While one runs the next is queued once it is done.
+	void invalidate(const string &topic, const vector<string> &tickers = vector<string>())
+	{
+		lock_guard<mutex> lock(mtx);
+		if(topics.find(topic) == topics.end())
+			return;
+
+		auto it = dirty.find(topic);
+		bool queued = it != dirty.end();
+		DirtyTickers &changed = dirty[topic];
+		if(tickers.empty())
+			changed.all = true;
+		else
+			changed.tickers.insert(tickers.begin(), tickers.end());
+
+		if(!queued && !refreshing.count(topic))
+			post_refresh(topic);
+	}
+
+	void invalidate_prefix(const string &prefix, const vector<string> &tickers = vector<string>())
+	{
+		vector<string> matching = topics_with_prefix(prefix);
+		for(auto it = matching.begin(); it != matching.end(); ++it)
+			invalidate(*it, tickers);
+	}
+};
+
+SubscriptionHub *SubscriptionHub::instance = NULL;
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include "json_writer.hpp"
+
+using namespace std;
+
+// interactive work (charts, deals, bookings) is always picked before batch work (risk reports)
+enum TaskPriority
+{
+	INTERACTIVE = 0,
+	BATCH = 1
+};
+
+struct TaskClassStats
+{
+	size_t depth; // queued, not started
+	size_t max_depth;
+	size_t submitted;
+	size_t completed;
+	double total_wait_ms; // queued to started
+};
+
+// Pool of worker threads for cpu and db heavy handler work, so io threads only parse, dispatch and send.
+// Batch work still gets one turn after every starvation_limit interactive tasks while it is waiting.
+class TaskScheduler
+{
+private:
+	struct Task
+	{
+		function<void()> work;
+		chrono::steady_clock::time_point queued;
+	};
+
+	static const int n_priority = 2;
+	static const int starvation_limit = 8;
+	static TaskScheduler *instance;
+
+	deque<Task> queues[n_priority];
+	TaskClassStats stats[n_priority];
+	int interactive_streak;
+	bool stopping;
+	mutex mtx;
+	condition_variable has_task;
+	vector<thread> workers;
+
+	// called with mtx held and at least one task queued
+	int pick_priority()
+	{
+		bool batch_waiting = !queues[BATCH].empty();
+		if(queues[INTERACTIVE].empty() || (batch_waiting && interactive_streak >= starvation_limit))
+		{
+			interactive_streak = 0;
+			return BATCH;
+		}
+
+		if(batch_waiting)
+			++interactive_streak;
+		return INTERACTIVE;
+	}
+
+	void work()
+	{
+		unique_lock<mutex> lock(mtx);
+		while(true)
+		{
+			has_task.wait(lock, [this]{ return stopping || !queues[INTERACTIVE].empty() || !queues[BATCH].empty(); });
+			if(queues[INTERACTIVE].empty() && queues[BATCH].empty())
+				return; // stopping and drained
+
+			int priority = pick_priority();
+			Task task = move(queues[priority].front());
+			queues[priority].pop_front();
+			--stats[priority].depth;
+			stats[priority].total_wait_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - task.queued).count();
+			lock.unlock();
+
+			try{
+				task.work();
+			}catch(const std::exception &exc){
+				cout << "task failed because:" << exc.what() << endl;
+			}catch(...){
+				cout << "task failed" << endl;
+			}
+
+			lock.lock();
+			++stats[priority].completed;
+		}
+	}
+
+public:
+	TaskScheduler(size_t n_threads = 0):interactive_streak(0),stopping(false)
+	{
+		for(int priority = 0; priority < n_priority; ++priority)
+			stats[priority] = TaskClassStats();
+
+		if(n_threads == 0)
+			n_threads = max(1u, thread::hardware_concurrency());
+
+		for(size_t i = 0; i < n_threads; ++i)
+			workers.push_back(thread(&TaskScheduler::work, this));
+	}
+
+	static TaskScheduler* get_instance()
+	{
+		if(!instance)
+			instance = new TaskScheduler();
+
+		return instance;
+	}
+
+	// create the shared instance with an explicit size, call before the first get_instance
+	static void init(size_t n_threads)
+	{
+		if(!instance)
+			instance = new TaskScheduler(n_threads);
+	}
+
+	void post(TaskPriority priority, function<void()> work)
+	{
+		lock_guard<mutex> lock(mtx);
+		Task task = {work, chrono::steady_clock::now()};
+		queues[priority].push_back(move(task));
+
+		TaskClassStats &s = stats[priority];
+		++s.submitted;
+		if(++s.depth > s.max_depth)
+			s.max_depth = s.depth;
+
+		has_task.notify_one();
+	}
+
+	TaskClassStats get_stats(TaskPriority priority)
+	{
+		lock_guard<mutex> lock(mtx);
+		return stats[priority];
+	}
+
+	string stats_as_json()
+	{
+		static const char *names[] = {"interactive", "batch"};
+		lock_guard<mutex> lock(mtx);
+
+		JsonWriter &writer = JsonWriter::thread_writer();
+		writer.begin_object();
+		writer.key("scheduler").begin_object();
+		for(int priority = 0; priority < n_priority; ++priority)
+		{
+			TaskClassStats &s = stats[priority];
+			double started = s.submitted - s.depth;
+			writer.key(names[priority]).begin_object();
+			writer.key("depth").value((long long)s.depth);
+			writer.key("max_depth").value((long long)s.max_depth);
+			writer.key("submitted").value((long long)s.submitted);
+			writer.key("completed").value((long long)s.completed);
+			writer.key("avg_wait_ms").value(started > 0 ? s.total_wait_ms / started : 0.0);
+			writer.end_object();
+		}
+		writer.end_object();
+		writer.end_object();
+
+		return writer.str();
+	}
+
+	// run what is queued, then join the workers
+	void stop()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+			has_task.notify_all();
+		}
+
+		for(auto it = workers.begin(); it != workers.end(); ++it)
+			if(it->joinable())
+				it->join();
+	}
+
+	~TaskScheduler()
+	{
+		stop();
+	}
+};
+
+TaskScheduler *TaskScheduler::instance = NULL;
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef TICKER_INDEX_HPP
+#define TICKER_INDEX_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "task_scheduler.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <iostream>
+
+using namespace std;
+
+struct TickerMatch
+{
+	string symbol;
+	string name;
+	double score;
+};
+
+// Symbols and company names of Tickers in sorted key lists, so a search is two binary searches and a scan
+// of the keys starting with the query. Matches are ranked by the search_* weights of Configuration: a
+// symbol match (twice for the whole symbol) beats a match on a word of the name, then having quotes to
+// chart and how often a symbol was charted decide. The index is rebuilt in the background every
+// init_refresh_seconds and swapped in whole, searches never wait for it.
+class TickerIndex
+{
+private:
+	struct Index
+	{
+		vector<string> symbols;
+		vector<string> names;
+		vector<bool> has_quotes;
+		vector<pair<string, uint32_t>> symbol_keys; // upper case symbol -> ticker
+		vector<pair<string, uint32_t>> name_keys; // upper case name and every word of it from the second on -> ticker
+		unordered_map<string, uint32_t> by_symbol;
+		unique_ptr<atomic<uint32_t>[]> charted;
+		chrono::steady_clock::time_point built;
+	};
+
+	static TickerIndex *instance;
+
+	mutex mtx;
+	shared_ptr<const Index> current;
+	bool loading;
+
+	TickerIndex():loading(false){}
+
+	static string upper(const string &s)
+	{
+		string u = s;
+		for(auto it = u.begin(); it != u.end(); ++it)
+			*it = toupper((unsigned char)*it);
+
+		return u;
+	}
+
+	static bool starts_with(const string &s, const string &prefix)
+	{
+		return s.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	// the keys of keys that start with prefix
+	static pair<vector<pair<string, uint32_t>>::const_iterator, vector<pair<string, uint32_t>>::const_iterator> prefix_range(const vector<pair<string, uint32_t>> &keys, const string &prefix)
+	{
+		auto first = lower_bound(keys.begin(), keys.end(), make_pair(prefix, (uint32_t)0));
+		auto last = first;
+		while(last != keys.end() && starts_with(last->first, prefix))
+			++last;
+
+		return make_pair(first, last);
+	}
+
+	void load()
+	{
+		shared_ptr<Index> index(new Index());
+		try{
+			MysqlManager *mysql_manager = MysqlManager::get_instance();
+			unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select Symbol, Name from Tickers"));
+			while(res->next())
+			{
+				string symbol = res->getString("Symbol");
+				index->by_symbol[symbol] = index->symbols.size();
+				index->symbols.push_back(symbol);
+				index->names.push_back(res->getString("Name"));
+			}
+
+			index->has_quotes.assign(index->symbols.size(), false);
+			unique_ptr<sql::ResultSet> quoted(mysql_manager->executeQuery("select distinct(Symbol) from Quotes"));
+			while(quoted->next())
+			{
+				auto it = index->by_symbol.find(quoted->getString("Symbol"));
+				if(it != index->by_symbol.end())
+					index->has_quotes[it->second] = true;
+			}
+		}catch(const std::exception &exc){
+			cout << "failed to load the ticker index because:" << exc.what() << endl;
+			lock_guard<mutex> lock(mtx);
+			loading = false;
+			return;
+		}
+
+		for(uint32_t id = 0; id < index->symbols.size(); ++id)
+		{
+			index->symbol_keys.push_back(make_pair(upper(index->symbols[id]), id));
+
+			string name = upper(index->names[id]);
+			if(name.empty())
+				continue;
+			index->name_keys.push_back(make_pair(name, id));
+			for(size_t space = name.find(' '); space != string::npos; space = name.find(' ', space + 1))
+				if(space + 1 < name.size() && name[space + 1] != ' ')
+					index->name_keys.push_back(make_pair(name.substr(space + 1), id));
+		}
+		sort(index->symbol_keys.begin(), index->symbol_keys.end());
+		sort(index->name_keys.begin(), index->name_keys.end());
+
+		index->charted.reset(new atomic<uint32_t>[index->symbols.size()]);
+		lock_guard<mutex> lock(mtx);
+		for(uint32_t id = 0; id < index->symbols.size(); ++id)
+		{
+			uint32_t count = 0;
+			if(current)
+			{
+				auto it = current->by_symbol.find(index->symbols[id]);
+				if(it != current->by_symbol.end())
+					count = current->charted[it->second].load(memory_order_relaxed);
+			}
+			index->charted[id].store(count, memory_order_relaxed);
+		}
+
+		index->built = chrono::steady_clock::now();
+		current = index;
+		loading = false;
+	}
+
+	// the index to search, a rebuild is queued when there is none yet or it is due
+	shared_ptr<const Index> get()
+	{
+		lock_guard<mutex> lock(mtx);
+		int refresh_seconds = Configuration::get_instance()->init_refresh_seconds;
+		bool due = !current || (refresh_seconds > 0 && chrono::steady_clock::now() - current->built > chrono::seconds(refresh_seconds));
+		if(due && !loading)
+		{
+			loading = true;
+			TaskScheduler::get_instance()->post(BATCH, [this]{ load(); });
+		}
+
+		return current;
+	}
+
+public:
+	static TickerIndex* get_instance()
+	{
+		if(!instance)
+			instance = new TickerIndex();
+
+		return instance;
+	}
+
+	// queue the first build so it is ready by the first search
+	void warm_up()
+	{
+		get();
+	}
+
+	// the best k tickers for query, a prefix of the symbol or of a word of the name, any case
+	vector<TickerMatch> search(const string &query, size_t k)
+	{
+		vector<TickerMatch> matches;
+		shared_ptr<const Index> index = get();
+		if(!index || k == 0)
+			return matches;
+
+		Configuration *settings = Configuration::get_instance();
+		string prefix = upper(query);
+		static thread_local vector<double> scores; // by ticker, -1 for no match
+		scores.assign(index->symbols.size(), -1);
+		vector<uint32_t> matched;
+
+		auto symbols = prefix_range(index->symbol_keys, prefix);
+		for(auto it = symbols.first; it != symbols.second; ++it)
+		{
+			if(scores[it->second] < 0)
+				matched.push_back(it->second);
+			scores[it->second] = settings->search_symbol_weight * (it->first.size() == prefix.size() ? 2 : 1);
+		}
+
+		// every symbol starts with "", the names can not add anything
+		auto names = prefix.empty() ? make_pair(index->name_keys.end(), index->name_keys.end()) : prefix_range(index->name_keys, prefix);
+		for(auto it = names.first; it != names.second; ++it)
+		{
+			if(scores[it->second] < 0)
+				matched.push_back(it->second);
+			scores[it->second] = max(scores[it->second], (double)settings->search_name_weight);
+		}
+
+		vector<pair<double, uint32_t>> ranked;
+		ranked.reserve(matched.size());
+		for(auto it = matched.begin(); it != matched.end(); ++it)
+		{
+			uint32_t id = *it;
+			double score = scores[id];
+			if(index->has_quotes[id])
+				score += settings->search_quotes_weight;
+			score += settings->search_popularity_weight * log2(1.0 + index->charted[id].load(memory_order_relaxed));
+			ranked.push_back(make_pair(score, id));
+		}
+
+		// best score first, then the shorter symbol, then alphabetically
+		size_t n = min(k, ranked.size());
+		partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(), [&index](const pair<double, uint32_t> &a, const pair<double, uint32_t> &b){
+			if(a.first != b.first)
+				return a.first > b.first;
+			const string &sa = index->symbols[a.second], &sb = index->symbols[b.second];
+			return sa.size() != sb.size() ? sa.size() < sb.size() : sa < sb;
+		});
+
+		for(size_t i = 0; i < n; ++i)
+			matches.push_back(TickerMatch{index->symbols[ranked[i].second], index->names[ranked[i].second], ranked[i].first});
+
+		return matches;
+	}
+
+	// symbol was charted, it ranks higher from now on
+	void charted(const string &symbol)
+	{
+		shared_ptr<const Index> index;
+		{
+			lock_guard<mutex> lock(mtx);
+			index = current;
+		}
+
+		if(!index)
+			return;
+
+		auto it = index->by_symbol.find(symbol);
+		if(it != index->by_symbol.end())
+			index->charted[it->second].fetch_add(1, memory_order_relaxed);
+	}
+};
+
+TickerIndex *TickerIndex::instance = NULL;
+
+#endif
@@ -0,0 +1,546 @@
+#ifndef TRADE_JOURNAL_HPP
+#define TRADE_JOURNAL_HPP
+
+#include "mysql.hpp"
+#include "configuration.hpp"
+#include "metrics.hpp"
+#include "date_util.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// one booking, "book1 book2 ticker quantity date", and where it sits in the journal
+struct Trade
+{
+	long long lsn;
+	string book1_id; // trading book
+	string book2_id; // customer book
+	string ticker;
+	long long quantity;
+	string date;
+	int rest; // trades of its basket journaled after it, 0 for the last one and for a trade booked alone
+
+	static const int field_num = 5;
+
+	Trade():lsn(0), quantity(0), rest(0){}
+
+	// false if any field is off, so nothing the db would refuse gets acknowledged
+	bool parse(const string &booking)
+	{
+		return error(booking).empty();
+	}
+
+	// parse booking, what is wrong with it or "" if nothing
+	string error(const string &booking)
+	{
+		stringstream ss(booking);
+		string quantity_text, extra;
+		if(!(ss >> book1_id >> book2_id >> ticker >> quantity_text >> date) || ss >> extra)
+			return "expected book1 book2 ticker quantity date";
+
+		char *end = NULL;
+		quantity = strtoll(quantity_text.c_str(), &end, 10);
+		if(*end != 0)
+			return "bad quantity";
+
+		return check();
+	}
+
+	// what is wrong with the fields or "" if nothing
+	string check() const
+	{
+		if(book1_id.empty() || book1_id.size() > 9 || book1_id.find_first_not_of("0123456789") != string::npos)
+			return "bad trading book";
+		if(book2_id.empty() || book2_id.size() > 9 || book2_id.find_first_not_of("0123456789") != string::npos)
+			return "bad customer book";
+		if(ticker.empty() || ticker.size() > 10 || ticker.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789.-^") != string::npos)
+			return "bad ticker";
+		if(quantity == 0 || quantity > 2147483647LL || quantity < -2147483647LL) // Quantity is an int
+			return "bad quantity";
+		if(parse_day(date) < 0)
+			return "bad date";
+
+		return "";
+	}
+
+	// the journal line without the newline
+	string line() const
+	{
+		string text = to_string(lsn) + " " + book1_id + " " + book2_id + " " + ticker + " " + to_string(quantity) + " " + date + " " + to_string(rest);
+		return text + " " + to_string(checksum(text));
+	}
+
+	// false for a line torn by a crash. Lines journaled before baskets have no rest, they are trades booked alone.
+	bool parse_line(const string &text)
+	{
+		size_t last = text.rfind(' ');
+		if(last == string::npos || text.substr(last + 1) != to_string(checksum(text.substr(0, last))))
+			return false;
+
+		stringstream ss(text.substr(0, last));
+		if(!(ss >> lsn >> book1_id >> book2_id >> ticker >> quantity >> date))
+			return false;
+
+		rest = 0;
+		string rest_text;
+		if(!(ss >> rest_text))
+			return true;
+
+		char *end = NULL;
+		rest = strtol(rest_text.c_str(), &end, 10);
+		return *end == 0 && rest >= 0 && !(ss >> rest_text);
+	}
+
+	static uint32_t checksum(const string &text)
+	{
+		uint32_t hash = 2166136261u; // fnv-1a
+		for(size_t i = 0; i < text.size(); ++i)
+			hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+
+		return hash;
+	}
+
+	void bind(sql::PreparedStatement *pstmt, int index) const
+	{
+		pstmt->setString(index, book1_id);
+		pstmt->setString(index + 1, book2_id);
+		pstmt->setString(index + 2, ticker);
+		pstmt->setInt64(index + 3, quantity);
+		pstmt->setString(index + 4, date);
+	}
+};
+
+// Write ahead journal of bookings. A trade is appended to a local file and acknowledged once it is fsync'd,
+// trades arriving while one fsync runs go together in the next (group commit), so a burst costs a handful
+// of fsyncs rather than a db commit per trade. A basket is journaled in one piece and applied in one
+// transaction, a basket cut short by a crash is dropped on replay as it was never acknowledged. A second
+// thread applies the journaled trades to Deal in batches, each in one transaction with the lsn it reaches in
+// Journal_Checkpoint, so after a crash the trades past the checkpoint are replayed from the file. While the
+// db is away the applier reconnects and retries, and reads the checkpoint first, so a batch whose commit
+// went through but was reported as failed is not applied twice.
+class TradeJournal
+{
+private:
+	struct Pending
+	{
+		vector<Trade> trades; // one, or a basket
+		function<void(bool)> done; // called with true once they are durable
+	};
+
+	static TradeJournal *instance;
+
+	mutex mtx;
+	int fd;
+	size_t file_size;
+	long long next_lsn;
+	long long durable_lsn;
+	long long applied_lsn;
+	vector<Pending> pending; // waiting for the next fsync
+	deque<Trade> to_apply; // durable, not in Deal yet
+	bool writing;
+	bool applying;
+	bool broken; // a torn group could not be cut off, nothing more can be journaled safely
+	condition_variable appended;
+	condition_variable journaled;
+	thread writer;
+	thread applier;
+	function<void(const vector<Trade>&)> on_applied;
+	function<void(const vector<Trade>&)> on_replayed;
+	function<void(const vector<Trade>&)> on_skipped;
+
+	atomic<long long> *fsyncs;
+	atomic<long long> *journaled_trades;
+	atomic<long long> *applied_trades;
+	atomic<long long> *skipped_trades;
+
+	TradeJournal():fd(-1), file_size(0), next_lsn(1), durable_lsn(0), applied_lsn(0), writing(false), applying(false), broken(false)
+	{
+		Metrics *metrics = Metrics::get_instance();
+		fsyncs = metrics->counter("journal_fsyncs_total");
+		journaled_trades = metrics->counter("journal_trades_total", "state=\"journaled\"");
+		applied_trades = metrics->counter("journal_trades_total", "state=\"applied\"");
+		skipped_trades = metrics->counter("journal_trades_total", "state=\"skipped\"");
+	}
+
+	static string checkpoint_query(long long lsn)
+	{
+		return "insert into Journal_Checkpoint(Journal, LSN) values('trades', " + to_string(lsn) + ") on duplicate key update LSN = greatest(LSN, values(LSN))";
+	}
+
+	static bool write_all(int fd, const string &text)
+	{
+		size_t written = 0;
+		while(written < text.size())
+		{
+			ssize_t n = write(fd, text.data() + written, text.size() - written);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			written += n;
+		}
+
+		return true;
+	}
+
+	void group_commit()
+	{
+		unique_lock<mutex> lock(mtx);
+		while(true)
+		{
+			appended.wait(lock, [this]{ return !pending.empty() || !writing; });
+			if(pending.empty())
+				break;
+
+			// everything in the file is in Deal, start it over rather than let it grow
+			if(to_apply.empty() && applied_lsn == durable_lsn && file_size > (size_t)Configuration::get_instance()->journal_rotate_bytes && ftruncate(fd, 0) == 0)
+				file_size = 0;
+
+			vector<Pending> group;
+			group.swap(pending);
+			lock.unlock();
+
+			string text;
+			size_t n_trades = 0;
+			for(auto it = group.begin(); it != group.end(); ++it)
+			{
+				for(auto trade = it->trades.begin(); trade != it->trades.end(); ++trade)
+					text += trade->line() + "\n";
+				n_trades += it->trades.size();
+			}
+
+			bool durable = write_all(fd, text) && fdatasync(fd) == 0;
+			fsyncs->fetch_add(1, memory_order_relaxed);
+			if(!durable)
+			{
+				cout << "failed to write the trade journal because:" << strerror(errno) << endl;
+				if(ftruncate(fd, file_size) != 0) // no torn group in front of the next one
+				{
+					// a replay would stop at the torn group and drop everything acknowledged after it
+					cout << "failed to cut the trade journal back because:" << strerror(errno) << ", bookings are refused from now on" << endl;
+					lock.lock();
+					broken = true;
+					writing = false;
+					for(auto it = pending.begin(); it != pending.end(); ++it)
+						group.push_back(*it);
+					pending.clear();
+					lock.unlock();
+				}
+			}
+
+			lock.lock();
+			if(durable)
+			{
+				file_size += text.size();
+				durable_lsn = group.back().trades.back().lsn;
+				for(auto it = group.begin(); it != group.end(); ++it)
+					to_apply.insert(to_apply.end(), it->trades.begin(), it->trades.end());
+				journaled.notify_one();
+				journaled_trades->fetch_add(n_trades, memory_order_relaxed);
+			}
+			lock.unlock();
+
+			for(auto it = group.begin(); it != group.end(); ++it)
+				it->done(durable);
+
+			lock.lock();
+		}
+	}
+
+	// one transaction for trades and the checkpoint after them, false if it rolled back
+	static bool apply(MysqlManager *mysql_manager, const vector<Trade> &trades)
+	{
+		return mysql_manager->executeBatchUpdateAtomically("insert into Deal(Book1_ID, Book2_ID, Ticker, Quantity, Date) values", trades,
+				"on duplicate key update Quantity=Quantity+values(Quantity)", max(1, Configuration::get_instance()->journal_apply_batch), checkpoint_query(trades.back().lsn)) >= 0;
+	}
+
+	// how far Journal_Checkpoint has the journal, the trades up to it are in Deal whatever the client was told
+	static long long db_checkpoint(MysqlManager *mysql_manager)
+	{
+		unique_ptr<sql::ResultSet> res(mysql_manager->executeQuery("select LSN from Journal_Checkpoint where Journal = 'trades'"));
+		return res->next() ? res->getInt64("LSN") : 0;
+	}
+
+	// after a failure a commit may have gone through all the same: the trades of batch from handled on
+	// that the checkpoint covers go to applied rather than to Deal a second time
+	static size_t committed(MysqlManager *mysql_manager, const vector<Trade> &batch, size_t handled, vector<Trade> &applied)
+	{
+		long long checkpoint = db_checkpoint(mysql_manager);
+		while(handled < batch.size() && batch[handled].lsn <= checkpoint)
+			applied.push_back(batch[handled++]);
+
+		return handled;
+	}
+
+	void apply_batches()
+	{
+		bool uncertain = false; // the last attempt failed, it may have committed anyway
+		unique_lock<mutex> lock(mtx);
+		while(true)
+		{
+			journaled.wait(lock, [this]{ return !to_apply.empty() || !applying; });
+			if(to_apply.empty())
+				break;
+
+			// a basket goes whole, however big
+			size_t n = min(to_apply.size(), (size_t)max(1, Configuration::get_instance()->journal_apply_batch));
+			while(to_apply[n - 1].rest > 0 && n < to_apply.size())
+				++n;
+			vector<Trade> batch(to_apply.begin(), to_apply.begin() + n);
+			to_apply.erase(to_apply.begin(), to_apply.begin() + n);
+			lock.unlock();
+
+			vector<Trade> applied;
+			size_t handled = 0; // applied or skipped, the rest go back when the db is away
+			try{
+				bool done = false;
+				for(int attempt = 0; attempt < 3 && !done; ++attempt)
+				{
+					if(attempt > 0)
+					{
+						this_thread::sleep_for(chrono::seconds(1));
+						MysqlManager::reset(); // a lost connection never comes back by itself
+					}
+
+					MysqlManager *mysql_manager = MysqlManager::get_instance();
+					if(uncertain)
+						handled = committed(mysql_manager, batch, handled, applied);
+					done = handled == batch.size() || apply(mysql_manager, vector<Trade>(batch.begin() + handled, batch.end()));
+					uncertain = !done;
+				}
+
+				MysqlManager *mysql_manager = MysqlManager::get_instance();
+				if(done)
+				{
+					applied.insert(applied.end(), batch.begin() + handled, batch.end());
+					handled = batch.size();
+				}
+				else
+				{
+					unique_ptr<sql::ResultSet> alive(mysql_manager->executeQuery("select 1")); // throws when the db is away rather than a trade
+
+					// one of them is refused, find it by applying them one by one, a basket as one
+					while(handled < batch.size())
+					{
+						size_t end = handled + 1;
+						while(batch[end - 1].rest > 0 && end < batch.size())
+							++end;
+
+						vector<Trade> unit(batch.begin() + handled, batch.begin() + end);
+						if(apply(mysql_manager, unit) || db_checkpoint(mysql_manager) >= unit.back().lsn)
+							applied.insert(applied.end(), unit.begin(), unit.end());
+						else
+						{
+							cout << "failed to apply journaled trades from " << unit.front().line() << ", " << unit.size() << " skipped" << endl;
+							skipped_trades->fetch_add(unit.size(), memory_order_relaxed);
+							if(on_skipped)
+								on_skipped(unit);
+						}
+						handled = end;
+					}
+					uncertain = false;
+				}
+			}catch(const std::exception &exc){
+				cout << "failed to apply journaled trades because:" << exc.what() << endl;
+				MysqlManager::reset();
+				uncertain = true;
+			}
+
+			// the db is away, keep the rest of the batch and try again in a while, or leave it to the replay on restart
+			if(handled < batch.size())
+			{
+				lock.lock();
+				to_apply.insert(to_apply.begin(), batch.begin() + handled, batch.end());
+				lock.unlock();
+			}
+
+			applied_trades->fetch_add(applied.size(), memory_order_relaxed);
+			if(on_applied && !applied.empty())
+				on_applied(applied);
+
+			lock.lock();
+			if(handled == batch.size())
+				applied_lsn = batch.back().lsn;
+			else if(!applying)
+				break;
+			else
+				journaled.wait_for(lock, chrono::seconds(1), [this]{ return !applying; });
+		}
+	}
+
+public:
+	static TradeJournal* get_instance()
+	{
+		if(!instance)
+			instance = new TradeJournal();
+
+		return instance;
+	}
+
+	// what to do with trades once they are in Deal, e.g. tell the books' subscribers
+	void set_on_applied(function<void(const vector<Trade>&)> applied)
+	{
+		lock_guard<mutex> lock(mtx);
+		on_applied = applied;
+	}
+
+	// what to do with trades the db refused, they were acknowledged but never make it to Deal
+	void set_on_skipped(function<void(const vector<Trade>&)> skipped)
+	{
+		lock_guard<mutex> lock(mtx);
+		on_skipped = skipped;
+	}
+
+	// what to do with the trades start finds in the journal but not in Deal yet, before any of them is applied
+	void set_on_replayed(function<void(const vector<Trade>&)> replayed)
+	{
+		lock_guard<mutex> lock(mtx);
+		on_replayed = replayed;
+	}
+
+	// open the journal, queue what it holds past the checkpoint in the db for applying and start the
+	// writer and the applier. false if the journal can not be opened.
+	bool start(const string &path)
+	{
+		long long checkpoint = 0;
+		try{
+			checkpoint = db_checkpoint(MysqlManager::get_instance());
+		}catch(const std::exception &exc){
+			cout << "failed to read the journal checkpoint because:" << exc.what() << endl;
+			return false;
+		}
+
+		// the valid lines up to a torn one, which is cut off so appends go after the last good line
+		ifstream journal(path);
+		string text;
+		size_t valid_size = 0;
+		long long last_lsn = 0;
+		deque<Trade> replay;
+		size_t basket_start = 0; // where the basket of the last line started, in the file and in replay
+		size_t basket_replay = 0;
+		int rest = 0;
+		while(getline(journal, text))
+		{
+			Trade trade;
+			if(journal.eof() || !trade.parse_line(text) || trade.lsn <= last_lsn || (rest > 0 && trade.rest != rest - 1))
+				break;
+
+			if(rest == 0)
+			{
+				basket_start = valid_size;
+				basket_replay = replay.size();
+			}
+			valid_size += text.size() + 1;
+			if(trade.lsn > checkpoint)
+				replay.push_back(trade);
+			last_lsn = trade.lsn;
+			rest = trade.rest;
+		}
+
+		// the last basket did not make it to the file whole
+		if(rest > 0)
+		{
+			valid_size = basket_start;
+			replay.resize(min(replay.size(), basket_replay));
+		}
+		last_lsn = max(last_lsn, checkpoint);
+		journal.close();
+
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if(fd < 0 || ftruncate(fd, valid_size) != 0)
+		{
+			cout << "failed to open the trade journal " << path << " because:" << strerror(errno) << endl;
+			return false;
+		}
+
+		if(!replay.empty())
+		{
+			cout << "replay " << replay.size() << " journaled trades past lsn " << checkpoint << endl;
+			if(on_replayed)
+				on_replayed(vector<Trade>(replay.begin(), replay.end()));
+		}
+
+		lock_guard<mutex> lock(mtx);
+		file_size = valid_size;
+		next_lsn = last_lsn + 1;
+		durable_lsn = last_lsn;
+		applied_lsn = replay.empty() ? last_lsn : checkpoint;
+		to_apply.swap(replay);
+		writing = true;
+		applying = true;
+		writer = thread(&TradeJournal::group_commit, this);
+		applier = thread(&TradeJournal::apply_batches, this);
+		return true;
+	}
+
+	// bookings go through the journal, append refuses them once it is broken
+	bool running()
+	{
+		lock_guard<mutex> lock(mtx);
+		return writing || broken;
+	}
+
+	// journal trades, all or none of them: done(true) once they are durable, done(false) if they can not be
+	// written. More than one trade is a basket, applied to Deal in one transaction.
+	void append(vector<Trade> trades, function<void(bool)> done)
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			if(writing && !trades.empty())
+			{
+				for(size_t i = 0; i < trades.size(); ++i)
+				{
+					trades[i].lsn = next_lsn++;
+					trades[i].rest = trades.size() - 1 - i;
+				}
+				pending.push_back(Pending{trades, done});
+				appended.notify_one();
+				return;
+			}
+		}
+
+		done(false);
+	}
+
+	// write what was appended, apply what was written, then stop
+	void stop()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			writing = false;
+			appended.notify_all();
+		}
+		if(writer.joinable())
+			writer.join();
+
+		{
+			lock_guard<mutex> lock(mtx);
+			applying = false;
+			journaled.notify_all();
+		}
+		if(applier.joinable())
+			applier.join();
+
+		if(fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+};
+
+TradeJournal *TradeJournal::instance = NULL;
+
+#endif